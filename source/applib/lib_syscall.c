@@ -241,3 +241,81 @@ int unlink(const char *file_name) {
 
 
 
+
+void *mmap(void *addr, int len, int prot, int flags, int fd, int offset) {
+    syscall_args_t args;
+    args.id = SYS_mmap;
+    args.arg0 = (uint32_t)len;
+    args.arg1 = (uint32_t)(prot | (flags << 8)); // only 4 args are passed
+    args.arg2 = (uint32_t)fd;
+    args.arg3 = (uint32_t)offset;
+    return (void*)sys_call(&args);
+}
+
+int munmap(void *addr, int len) {
+    syscall_args_t args;
+    args.id = SYS_munmap;
+    args.arg0 = (uint32_t)addr;
+    args.arg1 = (uint32_t)len;
+    return sys_call(&args);
+}
+
+int pipe(int fds[2]) {
+    syscall_args_t args;
+    args.id = SYS_pipe;
+    args.arg0 = (uint32_t)fds;
+    return sys_call(&args);
+}
+
+int sendfile(int out_fd, int in_fd, int *offset, int count) {
+    syscall_args_t args;
+    args.id = SYS_sendfile;
+    args.arg0 = (uint32_t)out_fd;
+    args.arg1 = (uint32_t)in_fd;
+    args.arg2 = (uint32_t)offset;
+    args.arg3 = (uint32_t)count;
+    return sys_call(&args);
+}
+
+int dmesg(char *buf, int size) {
+    syscall_args_t args;
+    args.id = SYS_dmesg;
+    args.arg0 = (uint32_t)buf;
+    args.arg1 = (uint32_t)size;
+    return sys_call(&args);
+}
+
+int trace(int cmd, char *buf, int size) {
+    syscall_args_t args;
+    args.id = SYS_trace;
+    args.arg0 = (uint32_t)cmd;
+    args.arg1 = (uint32_t)buf;
+    args.arg2 = (uint32_t)size;
+    return sys_call(&args);
+}
+
+int ps(task_info_t *infos, int count, task_clock_t *clock) {
+    syscall_args_t args;
+    args.id = SYS_ps;
+    args.arg0 = (uint32_t)infos;
+    args.arg1 = (uint32_t)count;
+    args.arg2 = (uint32_t)clock;
+    return sys_call(&args);
+}
+
+int get_clock(task_clock_t *clock) {
+    syscall_args_t args;
+    args.id = SYS_get_clock;
+    args.arg0 = (uint32_t)clock;
+    return sys_call(&args);
+}
+
+int prof(int cmd, int arg, char *buf, int size) {
+    syscall_args_t args;
+    args.id = SYS_prof;
+    args.arg0 = (uint32_t)cmd;
+    args.arg1 = (uint32_t)arg;
+    args.arg2 = (uint32_t)buf;
+    args.arg3 = (uint32_t)size;
+    return sys_call(&args);
+}
@@ -4,6 +4,7 @@
 #include "os_cfg.h"
 #include "comm/types.h"
 #include "core/syscall.h"
+#include "core/task_stat.h"
 #include <sys/stat.h>
 
 typedef struct _syscall_args_t {
@@ -30,6 +31,40 @@ int lseek(int file, int ptr, int dir);
 int ioctl(int file, int cmd, int arg0, int arg1);
 int unlink(const char *file_name);
 
+#define PROT_READ 1
+#define PROT_WRITE 2
+#define PROT_EXEC 4
+#define MAP_SHARED 1
+#define MAP_PRIVATE 2
+#define MAP_FAILED ((void*)-1)
+
+// addr is only a hint and ignored, kernel picks the address
+void *mmap(void *addr, int len, int prot, int flags, int fd, int offset);
+int munmap(void *addr, int len);
+
+// fds[0] is the read end, fds[1] is the write end
+int pipe(int fds[2]);
+
+// copy between two files in the kernel, returns bytes copied, 0 at the end of in_fd
+// offset may be null, then the position of in_fd is used and advanced
+int sendfile(int out_fd, int in_fd, int *offset, int count);
+
+// copy the kernel log as text to buf, returns the bytes copied
+int dmesg(char *buf, int size);
+
+// start or stop kernel tracing, or copy the trace buffer to buf (TRACE_CMD_xxx in tools/trace.h)
+int trace(int cmd, char *buf, int size);
+
+// start or stop the sampling profiler, or copy the samples to buf (PROF_CMD_xxx in tools/prof.h)
+int prof(int cmd, int arg, char *buf, int size);
+
+// fill infos with up to count tasks and their stats, returns how many
+// clock may be null, it is used to turn the cpu cycles into time
+int ps(task_info_t *infos, int count, task_clock_t *clock);
+
+// read the tsc and the tick count at the same moment, for timing code
+int get_clock(task_clock_t *clock);
+
 int isatty(int file);
 int fstat(int files, struct stat *st);
 void *sbrk(ptrdiff_t incr);
@@ -46,6 +81,7 @@ struct dirent {
 
 typedef struct _DIR {
     int index;
+    int cluster; // first cluster of the directory, 0 for root
     struct dirent dirent;
 }DIR;
 
@@ -135,6 +135,14 @@ static inline void write_eflags(uint32_t eflags) {
     __asm__ __volatile__("push %%eax\n\tpopf"::"a"(eflags));
 }
 
+// time stamp counter, counts cpu cycles since reset
+// "=A" is the edx:eax pair on i386
+static inline uint64_t rdtsc(void) {
+    uint64_t tsc;
+    __asm__ __volatile__("rdtsc":"=A"(tsc));
+    return tsc;
+}
+
 #endif
 
 
@@ -43,6 +43,11 @@ typedef struct {
 
 #define PT_LOAD 1
 
+// p_flags
+#define PF_X 1
+#define PF_W 2
+#define PF_R 4
+
 #pragma pack()
 
 #endif
\ No newline at end of file
@@ -3,6 +3,8 @@
 #include "tools/klib.h"
 #include "cpu/mmu.h"
 #include "dev/console.h"
+#include "core/vma.h"
+#include "cpu/cpu.h"
 
 #define MEM_EXT_START (1024 * 1024)
 #define MEM_EBDA_START (0x80000)
@@ -20,6 +22,7 @@ uint32_t mem_size, uint32_t page_size) {
     mem_alloc->start = mem_start;
     mem_alloc->size = mem_size;
     mem_alloc->page_size = page_size;
+    mem_alloc->page_ref = (uint16_t*)0;
 }
 
 // allocate (page_count) pages
@@ -31,6 +34,11 @@ static uint32_t _mem_alloc_page(mem_alloc_t *mem_alloc, int page_count) {
     int page_index = bitmap_alloc_nbits(&mem_alloc->bitmap, 0, page_count);
     if (page_index >= 0) {
         addr = (mem_alloc->start) + mem_alloc->page_size * page_index;
+        if (mem_alloc->page_ref) {
+            for (int i = 0; i < page_count; i++) {
+                mem_alloc->page_ref[page_index + i] = 1;
+            }
+        }
     }
 
     mutex_unlock(&mem_alloc->mutex);
@@ -38,6 +46,79 @@ static uint32_t _mem_alloc_page(mem_alloc_t *mem_alloc, int page_count) {
     return addr;
 }
 
+// free pages zeroed in advance by the idle task, so that page tables,
+// page directories and zero filled pages don't pay for zeroing when they are allocated
+// pages in the pool are allocated (bitmap bit set, ref is 1)
+// the pool is only touched with interrupts disabled, since the idle task can't wait on the mutex
+static uint32_t zero_pool[MEM_ZERO_POOL_SIZE];
+static int zero_pool_count;
+
+static uint32_t zero_pool_get(void) {
+    uint32_t addr = 0;
+    irq_state_t state = irq_enter_protection();
+    if (zero_pool_count > 0) {
+        addr = zero_pool[--zero_pool_count];
+    }
+    irq_leave_protection(state);
+    return addr;
+}
+
+// allocate a page filled with zeroes, it is zeroed here only if the pool is empty
+static uint32_t _mem_alloc_zero_page(mem_alloc_t *mem_alloc) {
+    uint32_t addr = zero_pool_get();
+    if (addr) {
+        return addr;
+    }
+
+    addr = _mem_alloc_page(mem_alloc, 1);
+    if (addr) {
+        kernel_page_zero((void*)addr);
+    }
+    return addr;
+}
+
+uint32_t mem_alloc_zero_page(void) {
+    return _mem_alloc_zero_page(&mem_alloc);
+}
+
+// called by the idle task to refill the pool
+// it gives up when the allocator is locked, since the idle task must never sleep
+// (interrupts disabled is enough to use the bitmap when nobody holds the lock)
+void memory_fill_zero_pool(void) {
+    for (;;) {
+        irq_state_t state = irq_enter_protection();
+        if (zero_pool_count >= MEM_ZERO_POOL_SIZE || mem_alloc.mutex.locked_count || !mem_alloc.page_ref) {
+            irq_leave_protection(state);
+            return;
+        }
+
+        int page_index = bitmap_alloc_nbits(&mem_alloc.bitmap, 0, 1);
+        if (page_index < 0) {
+            irq_leave_protection(state);
+            return;
+        }
+        mem_alloc.page_ref[page_index] = 1;
+        irq_leave_protection(state);
+
+        // zeroing is done with interrupts enabled, any task ready to run preempts it
+        uint32_t addr = mem_alloc.start + mem_alloc.page_size * page_index;
+        kernel_page_zero((void*)addr);
+
+        state = irq_enter_protection();
+        zero_pool[zero_pool_count++] = addr;
+        irq_leave_protection(state);
+    }
+}
+
+// count of present entries of every page table, indexed by page like page_ref
+// so that empty page tables are freed (or skipped) without scanning their 1024 entries
+static uint16_t *pte_count;
+
+static uint16_t *pte_count_of(pte_t *pte) {
+    uint32_t page_table = (uint32_t)pte & ~(MEM_PAGE_SIZE - 1);
+    return pte_count + (page_table - mem_alloc.start) / MEM_PAGE_SIZE;
+}
+
 pte_t *find_pte(pde_t *page_dir, uint32_t vstart, int alloc) {
     pde_t *pde = page_dir + pde_index(vstart);
     if (pde->present) {
@@ -47,16 +128,14 @@ pte_t *find_pte(pde_t *page_dir, uint32_t vstart, int alloc) {
             return (pte_t*)0;
         }
         // create a page table, page table is of size 4096
-        uint32_t phy_pt_addr = _mem_alloc_page(&mem_alloc, 1);
+        // important! the new page table must be zeroed, so stale present bits aren't read as mappings
+        uint32_t phy_pt_addr = _mem_alloc_zero_page(&mem_alloc);
         if (phy_pt_addr == 0) {
             return (pte_t *)0;
         }
          // set up pde
         pde->v = phy_pt_addr | PDE_P | PDE_U | PDE_W;
-        // important! otherwise there might some present bits might be 1
-        // if remove this line next time when we want to insert to a new pte
-        // it already has present bit 1
-        kernel_memset((uint8_t*)phy_pt_addr, 0, MEM_PAGE_SIZE); 
+        *pte_count_of((pte_t*)phy_pt_addr) = 0;
        
         
         return (pte_t*)phy_pt_addr + pte_index(vstart);
@@ -65,16 +144,65 @@ pte_t *find_pte(pde_t *page_dir, uint32_t vstart, int alloc) {
 
 // exported version of mem_alloc_page
 uint32_t mem_alloc_page(int page_count) {
-    return _mem_alloc_page(&mem_alloc, page_count);
+    uint32_t addr = _mem_alloc_page(&mem_alloc, page_count);
+    if (!addr && page_count == 1) {
+        // the pages in the zeroed pool are still free memory
+        addr = zero_pool_get();
+    }
+    return addr;
+}
+
+// drop a reference of the pages, the caller holds the lock
+static void mem_put_page(mem_alloc_t *mem_alloc, uint32_t start, int page_count) {
+    int page_index = (start - mem_alloc->start) / (mem_alloc->page_size);
+    if (!mem_alloc->page_ref) {
+        bitmap_set_bit(&mem_alloc->bitmap, page_index, page_count, 0);
+        return;
+    }
+
+    // a shared page is only freed by its last user
+    for (int i = page_index; i < page_index + page_count; i++) {
+        if (mem_alloc->page_ref[i] > 1) {
+            mem_alloc->page_ref[i]--;
+            continue;
+        }
+        mem_alloc->page_ref[i] = 0;
+        bitmap_set_bit(&mem_alloc->bitmap, i, 1, 0);
+    }
 }
 
 static void _mem_free_page(mem_alloc_t *mem_alloc, uint32_t start, int page_count) {
     mutex_lock(&mem_alloc->mutex);
+    mem_put_page(mem_alloc, start, page_count);
+    mutex_unlock(&mem_alloc->mutex);
+}
 
-    int page_index = (start - mem_alloc->start) / (mem_alloc->page_size);
-    bitmap_set_bit(&mem_alloc->bitmap, page_index, page_count, 0);
+// all changes of present bit go through here to keep pte_count right
+void memory_set_pte(pte_t *pte, uint32_t v) {
+    uint16_t *count = pte_count_of(pte);
+    if (!pte->present && (v & PTE_P)) {
+        (*count)++;
+    } else if (pte->present && !(v & PTE_P)) {
+        (*count)--;
+    }
+    pte->v = v;
+}
 
-    mutex_unlock(&mem_alloc->mutex);
+// unmap a user page and release it, the page table is freed once it is empty
+void memory_unmap_page(pde_t *page_dir, uint32_t vaddr) {
+    ASSERT(vaddr >= MEM_TASK_BASE); // page tables of kernel are shared by all tasks
+    pte_t *pte = find_pte(page_dir, vaddr, 0);
+    if (!pte || !pte->present) {
+        return;
+    }
+
+    _mem_free_page(&mem_alloc, pte_paddr(pte), 1);
+    memory_set_pte(pte, 0);
+    if (*pte_count_of(pte) == 0) {
+        pde_t *pde = page_dir + pde_index(vaddr);
+        _mem_free_page(&mem_alloc, pde_paddr(pde), 1);
+        pde->v = 0;
+    }
 }
 
 void mem_free_page(uint32_t addr, int page_count) {
@@ -83,15 +211,28 @@ void mem_free_page(uint32_t addr, int page_count) {
     if (addr < MEM_TASK_BASE) {
         _mem_free_page(&mem_alloc, addr, page_count);
     } else {
-        pte_t *pte = find_pte((pde_t*)(task_current()->tss.cr3), addr, 0);
-        ASSERT(pte && pte->present);
-        _mem_free_page(&mem_alloc, addr, page_count);
-        pte->v = 0; // this sets present bit
+        // the physical pages behind a user address may not be continuous
+        for (int i = 0; i < page_count; i++, addr += MEM_PAGE_SIZE) {
+            memory_unmap_page((pde_t*)(task_current()->tss.cr3), addr);
+        }
     }
 
     return;
 }
 
+// one more user of the page, e.g. the page is mapped by another task
+void mem_page_ref(uint32_t paddr) {
+    mutex_lock(&mem_alloc.mutex);
+    int page_index = (paddr - mem_alloc.start) / mem_alloc.page_size;
+    mem_alloc.page_ref[page_index]++;
+    mutex_unlock(&mem_alloc.mutex);
+}
+
+int mem_page_refcount(uint32_t paddr) {
+    int page_index = (paddr - mem_alloc.start) / mem_alloc.page_size;
+    return mem_alloc.page_ref[page_index];
+}
+
 static void show_mem_info(boot_info_t *boot_info) {
     log_printf("mem region:");
     for (int i = 0; i < boot_info->ram_region_count; i++) {
@@ -122,7 +263,7 @@ int memory_create_map(pde_t *page_dir, uint32_t vstart, uint32_t pstart, int pag
         // log_printf("pte addr: 0x%x", (uint32_t)pte);
         ASSERT(pte->present == 0);
 
-        pte->v = pstart | PTE_P | perm;
+        memory_set_pte(pte, pstart | PTE_P | perm);
         
         vstart += MEM_PAGE_SIZE;
         pstart += MEM_PAGE_SIZE;
@@ -161,13 +302,12 @@ static void create_kernel_table(void) {
 // set make lower pdes point to kernel pages (which is already created)
 // return page dir addr
 uint32_t memory_create_uvm(void) {
-    uint32_t pg_dir_addr = _mem_alloc_page(&mem_alloc, 1);
+    // page directory needs to be initialized (zeroed)
+    uint32_t pg_dir_addr = _mem_alloc_zero_page(&mem_alloc);
     if (pg_dir_addr == 0) {
         return 0;
     }
 
-    // page directory needs to be initialized
-    kernel_memset((void*)pg_dir_addr, 0, MEM_PAGE_SIZE);
     uint32_t user_pde_start = pde_index(MEM_TASK_BASE); // until the start of task code
     pde_t *p = (pde_t*)pg_dir_addr;
     for (int i = 0; i < user_pde_start; i++) {
@@ -236,59 +376,22 @@ void memory_init(boot_info_t *boot_info) {
 
     ASSERT(mem_free < (uint8_t*)MEM_EBDA_START);
 
+    // reference counts are too large to be placed below MEM_EBDA_START, so they're allocated
+    // from the allocator itself (these pages are never freed, so no counts are needed for them)
+    // pte counts are allocated in the same way
+    int ref_bytes = mem_alloc.size / MEM_PAGE_SIZE * sizeof(uint16_t);
+    uint16_t *page_ref = (uint16_t*)_mem_alloc_page(&mem_alloc, up(ref_bytes, MEM_PAGE_SIZE) / MEM_PAGE_SIZE);
+    ASSERT(page_ref != (uint16_t*)0);
+    kernel_memset(page_ref, 0, ref_bytes);
+    pte_count = (uint16_t*)_mem_alloc_page(&mem_alloc, up(ref_bytes, MEM_PAGE_SIZE) / MEM_PAGE_SIZE);
+    ASSERT(pte_count != (uint16_t*)0);
+    kernel_memset(pte_count, 0, ref_bytes);
+    mem_alloc.page_ref = page_ref;
+
     create_kernel_table();
 
     mmu_set_page_dir((uint32_t)kernel_page_dir);
-}
-
-uint32_t memory_copy_uvm(uint32_t page_dir) {
-    uint32_t to_page_dir = memory_create_uvm();
-    if (!to_page_dir) {
-        goto copy_uvm_failed;
-    }
-
-    uint32_t user_pde_start = pde_index(MEM_TASK_BASE);
-    pde_t *pde = (pde_t*)page_dir + user_pde_start;
-    for (int i = user_pde_start; i < PDE_CNT; i++, pde++) { // i and j are needed to calc virtual address
-        if (!pde->present) {
-            continue;
-        }
-
-        pte_t *pte = (pte_t *)pde_paddr(pde);
-        for (int j = 0; j < PTE_CNT; j++, pte++) {
-            if (!pte->present) {
-                continue;
-            }
-
-            // from_page_start is a phy addr, but is can also be viewed as a virt addr
-            // that points to "phy addr from_page_start", the phy addr from_page_start
-            // is also pointed by another virt addr "i << 22 | j << 12"
-            // uint32_t from_page_start = (uint32_t)pte->phy_page_addr << 12;
-            // we'll use "i << 22 | j << 12"
-            uint32_t from_page_start = (i << 22) | (j << 12);
-            uint32_t to_page_start = _mem_alloc_page(&mem_alloc, 1);
-            if (to_page_start == 0) {
-                goto copy_uvm_failed;
-            }
-
-            int created = memory_create_map((pde_t*)to_page_dir, from_page_start,
-                                            to_page_start, 1, get_pte_perm(pte));
-            if (created < 0) {
-                goto copy_uvm_failed;
-            }
-
-            kernel_memcpy((void*)to_page_start, (void*)from_page_start, MEM_PAGE_SIZE);
-        }
-    }
-
-    return to_page_dir;
-
-copy_uvm_failed:
-    if (to_page_dir) {
-        memory_destroy_uvm(to_page_dir);
-    }
-
-    return -1;
+    write_cr0(read_cr0() | CR0_WP);
 }
 
 void memory_destroy_uvm(uint32_t page_dir) {
@@ -296,6 +399,11 @@ void memory_destroy_uvm(uint32_t page_dir) {
         return;
     }
 
+    // all pages are returned under one lock
+    mutex_lock(&mem_alloc.mutex);
+
+    // usually the mappings are already removed by vma_destroy, which frees the emptied
+    // page tables as well, so only the leftovers are scanned here
     uint32_t user_start_index = pde_index(MEM_TASK_BASE);
     pde_t *pde = (pde_t*)page_dir + user_start_index;
     for (int i = user_start_index; i < PDE_CNT; i++, pde++) {
@@ -305,19 +413,37 @@ void memory_destroy_uvm(uint32_t page_dir) {
 
         uint32_t page_table = pde->phy_pt_addr << 12;
         pte_t *pte = (pte_t *)page_table;
-        for (int j = 0; j < PTE_CNT; j++, pte++) {
+        uint16_t *count = pte_count_of(pte);
+        for (int j = 0; j < PTE_CNT && *count; j++, pte++) {
             if (!pte->present) {
                 continue;
             }
 
-            uint32_t page = pte->phy_page_addr << 12;
-            _mem_free_page(&mem_alloc, page, 1);
+            mem_put_page(&mem_alloc, pte_paddr(pte), 1);
+            memory_set_pte(pte, 0);
         }
 
-        _mem_free_page(&mem_alloc, page_table, 1);
+        mem_put_page(&mem_alloc, page_table, 1);
     }
 
-    _mem_free_page(&mem_alloc, page_dir, 1);
+    mem_put_page(&mem_alloc, page_dir, 1);
+    mutex_unlock(&mem_alloc.mutex);
+}
+
+// resident pages of user space, the present entries are already counted per page table
+int memory_user_pages(uint32_t page_dir) {
+    if (!page_dir) {
+        return 0;
+    }
+
+    int pages = 0;
+    pde_t *pde = (pde_t*)page_dir + pde_index(MEM_TASK_BASE);
+    for (int i = pde_index(MEM_TASK_BASE); i < PDE_CNT; i++, pde++) {
+        if (pde->present) {
+            pages += *pte_count_of((pte_t*)pde_paddr(pde));
+        }
+    }
+    return pages;
 }
 
 uint32_t memory_get_paddr(uint32_t page_dir, uint32_t vaddr) {
@@ -380,16 +506,12 @@ char *sys_sbrk(int incr) {
         return (char*)ret;
     }
 
-    uint32_t offset = task->heap_end & (MEM_PAGE_SIZE - 1);
-    uint32_t left = MEM_PAGE_SIZE - offset;
-    if (incr < left) {
-        task->heap_end += incr;
-        return (char*)ret;
+    // heap pages are allocated when touched, the first one may be part of bss
+    uint32_t heap_vstart = up(task->heap_start, MEM_PAGE_SIZE);
+    uint32_t heap_vend = up(task->heap_end + incr, MEM_PAGE_SIZE);
+    if (heap_vend > heap_vstart && vma_set_heap(task, heap_vstart, heap_vend) < 0) {
+        return (char*)-1;
     }
-
-    uint32_t vstart = task->heap_end + left;
-    uint32_t page_count = up(incr - left + 1, MEM_PAGE_SIZE) / MEM_PAGE_SIZE;
-    alloc_mem_for_task(task->tss.cr3, page_count, vstart, PTE_U | PTE_W | PTE_P);
     task->heap_end += incr;
 
     return (char*)ret;
@@ -3,6 +3,11 @@
 #include "tools/log.h"
 #include "fs/fs.h"
 #include "core/memory.h"
+#include "core/vma.h"
+#include "fs/pipe.h"
+#include "tools/trace.h"
+#include "tools/prof.h"
+#include "dev/time.h"
 
 typedef int (*syscall_handler_t)(
     uint32_t arg0, uint32_t arg1, uint32_t arg2, uint32_t arg3
@@ -36,13 +41,26 @@ static const syscall_handler_t sys_table[] = {
     [SYS_closedir] = (syscall_handler_t)sys_closedir,
     [SYS_ioctl] = (syscall_handler_t)sys_ioctl,
     [SYS_unlink] = (syscall_handler_t)sys_unlink,
+    [SYS_mmap] = (syscall_handler_t)sys_mmap,
+    [SYS_munmap] = (syscall_handler_t)sys_munmap,
+    [SYS_pipe] = (syscall_handler_t)sys_pipe,
+    [SYS_sendfile] = (syscall_handler_t)sys_sendfile,
+    [SYS_dmesg] = (syscall_handler_t)sys_dmesg,
+    [SYS_trace] = (syscall_handler_t)sys_trace,
+    [SYS_prof] = (syscall_handler_t)sys_prof,
+    [SYS_ps] = (syscall_handler_t)sys_ps,
+    [SYS_get_clock] = (syscall_handler_t)sys_get_clock,
 };
 
 void do_handler_syscall(syscall_frame_t *frame) {
     if (frame->id < sizeof(sys_table) / sizeof(sys_table[0])) {
         syscall_handler_t handler = sys_table[frame->id];
         if (handler) {
+            trace_event(TRACE_SYSCALL, TRACE_BEGIN, frame->id, 0);
+            task_syscall_enter();
             int ret = handler(frame->arg0, frame->arg1, frame->arg2, frame->arg3);
+            task_syscall_exit();
+            trace_event(TRACE_SYSCALL, TRACE_END, frame->id, ret);
             frame->eax = ret;
             return;
         }
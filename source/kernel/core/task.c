@@ -11,18 +11,27 @@
 #include "core/syscall.h"
 #include "comm/elf.h"
 #include "fs/fs.h"
+#include "core/vma.h"
+#include "tools/trace.h"
+#include "dev/time.h"
 
 static task_manager_t task_manager;
 static uint32_t idle_task_stack[1024];
 static task_t task_table[TASK_NUM];
+static uint8_t task_free_list[TASK_NUM]; // indexes of unused entries of task_table, used as a stack
+static int task_free_count;
 static mutex_t task_table_mutex;
+static int task_preempted; // the next dispatch is because the time slice is used up
 
 void main_task_entry(int, int); // to test whether arguments matter
+static void free_task(task_t *task);
 
 static void idle_task_entry(void) {
     int i = 0;
     for (;;) {
         i++;
+        // spend the idle time on zeroing free pages for later allocations
+        memory_fill_zero_pool();
         hlt();
     }
 }
@@ -119,6 +128,14 @@ int task_init(task_t *task, const char *name, int flag, uint32_t entry, uint32_t
     // list_node_init(&task->wait_node);
 
     kernel_memset(&task->file_table, 0, sizeof(task->file_table));
+    kernel_memset(&task->fd_map, 0, sizeof(task->fd_map));
+    task->vmas = (vma_t*)0;
+    task->vma_count = 0;
+
+    kernel_memset(&task->stat, 0, sizeof(task->stat));
+    task->acct_tsc = rdtsc();
+    task->system = flag & TASK_FLAG_SYSTEM;
+    task->in_kernel = task->system;
 
     irq_state_t state = irq_enter_protection();
 
@@ -148,7 +165,15 @@ void task_start(task_t *task) {
     irq_leave_protection(state);
 }
 
+// the task must leave task_list before it is cleared, or the list is broken
+static void task_list_remove(task_t *task) {
+    irq_state_t state = irq_enter_protection();
+    list_remove_node(&task_manager.task_list, &task->all_node);
+    irq_leave_protection(state);
+}
+
 void task_uninit(task_t *task) {
+    task_list_remove(task);
     tss_uninit(task->tss, task->tss_sel);
     kernel_memset((void*)task, 0, sizeof(task_t));
 }
@@ -161,6 +186,10 @@ void task_switch_from_to(task_t *from, task_t *to) {
 void task_manager_init(void) {
     kernel_memset(task_table, 0, sizeof(task_table));
     mutex_init(&task_table_mutex);
+    for (int i = 0; i < TASK_NUM; i++) {
+        task_free_list[i] = TASK_NUM - 1 - i;
+    }
+    task_free_count = TASK_NUM;
 
     int sel = gdt_alloc_desc();
     segment_desc_set(sel, 0, 0xFFFFFFFF,
@@ -211,6 +240,9 @@ void main_task_init(void) {
     // we want to paste it so definitely with PTE_W
     alloc_mem_for_task(page_dir, page_count, (uint32_t)main_task_entry, PTE_P | PTE_W | PTE_U);
     kernel_memcpy(main_task_entry, &s_main_task, copy_size);
+    // code, data and stack of main task share these pages, fork copies them by this vma
+    vma_map_anon(&task_manager.main_task, (uint32_t)main_task_entry, page_count * MEM_PAGE_SIZE,
+                 PROT_READ | PROT_WRITE | PROT_EXEC, 0);
 
     task_start(&task_manager.main_task);
 }
@@ -258,6 +290,7 @@ void sys_exit(int status) {
             task->file_table[fd] = (file_t*)0;
         }
     }
+    vma_destroy(task);
 
     int set_ready_main = 0;
     mutex_lock(&task_table_mutex);
@@ -308,9 +341,12 @@ int sys_wait(int *status) {
                 int pid = task->pid;
                 *status = task->status;
                 // resource release
+                // out of task_list first, sys_ps reads the page dir of listed tasks
+                task_list_remove(task);
                 memory_destroy_uvm(task->tss.cr3);
                 mem_free_page(task->tss.esp0 - MEM_PAGE_SIZE, 1); // why?
                 kernel_memset(task, 0, sizeof(task_t));
+                free_task(task);
                 mutex_unlock(&task_table_mutex);
                 return pid;
             }
@@ -327,11 +363,43 @@ int sys_wait(int *status) {
     return 0;
 }
 
+// move the time since the last accounting into utime or stime
+static void task_account(task_t *task, uint64_t now) {
+    uint64_t delta = now - task->acct_tsc;
+    if (task->in_kernel) {
+        task->stat.stime += delta;
+    } else {
+        task->stat.utime += delta;
+    }
+    task->acct_tsc = now;
+}
+
+// called by do_handler_syscall, the time in between is system time
+void task_syscall_enter(void) {
+    irq_state_t state = irq_enter_protection();
+    task_t *curr = task_current();
+    task_account(curr, rdtsc());
+    curr->in_kernel = 1;
+    curr->stat.syscalls++;
+    irq_leave_protection(state);
+}
+
+void task_syscall_exit(void) {
+    irq_state_t state = irq_enter_protection();
+    task_t *curr = task_current();
+    task_account(curr, rdtsc());
+    curr->in_kernel = curr->system;
+    irq_leave_protection(state);
+}
+
 // select the next task and do switching
 void task_dispatch(void) {
     // this function will not only exist in sys_yield
     // it may be called independently, so we need protection
     irq_state_t state = irq_enter_protection();
+    // cleared before switching, the next dispatch may come from another task
+    int preempted = task_preempted;
+    task_preempted = 0;
 
     task_t *to = task_next_run();
     // if selected task equals the current task then no need to change
@@ -339,6 +407,15 @@ void task_dispatch(void) {
         return;
     }
     task_t* from = task_manager.curr_task;
+    trace_event(TRACE_SWITCH, TRACE_INSTANT, to->pid, 0);
+    uint64_t now = rdtsc();
+    task_account(from, now);
+    to->acct_tsc = now;
+    if (preempted) {
+        from->stat.nivcsw++;
+    } else {
+        from->stat.nvcsw++;
+    }
     task_manager.curr_task = to;
     to->state = TASK_RUNNING;
     task_switch_from_to(from, to);
@@ -367,6 +444,7 @@ void task_time_tick(void) {
         if (list_count(&task_manager.ready_list) > 1) {
             task_set_unready(task_manager.curr_task);
             task_set_ready(task_manager.curr_task);
+            task_preempted = 1;
             task_dispatch();
         }
     }
@@ -396,6 +474,43 @@ void sys_msleep(uint32_t ms) {
     irq_leave_protection(state);
 }
 
+// fill infos with the tasks that are not freed yet (zombies included), returns how many
+// clock (may be null) is taken at the same time, for turning cycles into time
+int sys_ps(task_info_t *infos, int count, task_clock_t *clock) {
+    if (!infos || count <= 0) {
+        return -1;
+    }
+
+    // no page fault may happen while the list is walked with interrupts off
+    vma_prefault((uint32_t)infos, count * sizeof(task_info_t), 1);
+    if (clock) {
+        vma_prefault((uint32_t)clock, sizeof(task_clock_t), 1);
+    }
+
+    irq_state_t state = irq_enter_protection();
+    task_account(task_manager.curr_task, rdtsc()); // the running task is counted up to now
+
+    int n = 0;
+    list_node_t *node = list_first(&task_manager.task_list);
+    while (node && n < count) {
+        task_t *task = parent_pointer(task_t, all_node, node);
+        task_info_t *info = infos + n++;
+        info->pid = task->pid;
+        info->ppid = task->parent ? task->parent->pid : 0;
+        info->state = task->state;
+        kernel_strncpy(info->name, task->name, TASK_NAME_SIZE);
+        kernel_memcpy(&info->stat, &task->stat, sizeof(task_stat_t));
+        info->rss = memory_user_pages(task->tss.cr3);
+        node = list_node_next(node);
+    }
+
+    if (clock) {
+        time_read_clock(clock);
+    }
+    irq_leave_protection(state);
+    return n;
+}
+
 uint32_t sys_getpid(void) {
     return task_current()->pid;
 }
@@ -420,11 +535,8 @@ static task_t *alloc_task(void) {
 
     mutex_lock(&task_table_mutex);
 
-    for (int i = 0; i < TASK_NUM; i++) {
-        if (task_table[i].pid == 0) {
-            task = &task_table[i];
-            break;
-        }
+    if (task_free_count > 0) {
+        task = task_table + task_free_list[--task_free_count];
     }
 
     mutex_unlock(&task_table_mutex);
@@ -436,6 +548,7 @@ static void free_task(task_t *task) {
     mutex_lock(&task_table_mutex);
 
     task->pid = 0;
+    task_free_list[task_free_count++] = task - task_table;
 
     mutex_unlock(&task_table_mutex);
 }
@@ -448,6 +561,18 @@ static void copy_opened_files(task_t *parent, task_t *child) {
             file_inc_ref(file);
         }
     }
+    kernel_memcpy(child->fd_map, parent->fd_map, sizeof(child->fd_map));
+}
+
+// undoes copy_opened_files when fork fails
+static void drop_opened_files(task_t *task) {
+    for (int i = 0; i < OPEN_FILE_NUM; i++) {
+        file_t *file = task->file_table[i];
+        if (file) {
+            fs_close_file(file);
+            task->file_table[i] = (file_t*)0;
+        }
+    }
 }
 
 // child process will start executing from the "next instruction of lcall"
@@ -463,15 +588,14 @@ int sys_fork(void) {
     task_t *parent = task_current();
     task_t *child = alloc_task();
     if (!child) {
-        goto fork_failed;
+        return -1;
     }
 
     syscall_frame_t *frame = (syscall_frame_t*)(parent->tss.esp0 - sizeof(syscall_frame_t)); // why?
 
-    int status = task_init(child, parent->name, 0, frame->eip,
-                           frame->esp + sizeof(uint32_t)*SYSCALL_PARAM_COUNT); // clean up params pushed
-    if (status < 0) {
-        goto fork_failed;
+    if (task_init(child, parent->name, 0, frame->eip,
+                  frame->esp + sizeof(uint32_t)*SYSCALL_PARAM_COUNT) < 0) { // clean up params pushed
+        goto init_failed;
     }
 
     copy_opened_files(parent, child);
@@ -493,69 +617,58 @@ int sys_fork(void) {
     child->tss.ebp = frame->ebp;
 
     child->parent = parent;
+    child->heap_start = parent->heap_start;
+    child->heap_end = parent->heap_end;
     // should not use the same page table, 
     // otherwise two processes will modify the same stack
     // child->tss.cr3 = parent->tss.cr3;
-    uint32_t cr3 = memory_copy_uvm(parent->tss.cr3);
-    if (cr3 < 0) {
-        goto fork_failed;
-    } else {
-        child->tss.cr3 = cr3;
+    // the page dir created by task_init is filled with the mapped ranges of parent,
+    // writable pages are shared until one of them writes
+    if (vma_copy(parent, child) < 0) {
+        goto copy_failed;
     }
 
     task_start(child);
     
     return child->pid;
 
-fork_failed:
-    if (child) {
-        free_task(child);
-    }
-    if (status) {
-        task_uninit(child);
-    }
-
+    // undone in reverse order, task_uninit takes the child out of task_list and
+    // frees the page dir (with the pages vma_copy shared), kernel stack and tss
+copy_failed:
+    vma_discard(child);
+    drop_opened_files(child);
+    task_uninit(child);
+init_failed:
+    free_task(child);
     return -1;
 }
 
-static int load_phdr(int file, Elf32_Phdr* phdr, uint32_t page_dir) {
-    int page_count = up(phdr->p_memsz, MEM_PAGE_SIZE) / MEM_PAGE_SIZE;
-    int ret = alloc_mem_for_task(page_dir, page_count, phdr->p_vaddr, PTE_P | PTE_U | PTE_W);
-    if (ret < 0) {
-        log_printf("alloc mem for task failed");
+// only the layout of segment is recorded, pages are loaded from file (or cleared for bss)
+// when they're touched for the first time, see vma_handle_fault
+// read-only pages come from page cache and are shared by every task running the same file
+static int load_phdr(int file, Elf32_Phdr* phdr) {
+    // pages of segment must have the same layout as the file
+    if ((phdr->p_vaddr ^ phdr->p_offset) & (MEM_PAGE_SIZE - 1)) {
+        log_printf("segment at 0x%x is not page aligned with file", phdr->p_vaddr);
         return -1;
     }
 
-    // move the pos in file to the start of doing copy
-    if (sys_lseek(file, phdr->p_offset, 0) < 0) {
-        log_printf("lseek failed");
-        return -1;
+    int prot = 0;
+    if (phdr->p_flags & PF_R) {
+        prot |= PROT_READ;
     }
-
-    // target address, however it can only be used with new page dir
-    // and we're currently using old page pir
-    // vaddr 4096 aligned, if not then we cannot do the stuffs in while loop
-    uint32_t vaddr = phdr->p_vaddr; 
-    uint32_t size = phdr->p_filesz;
-
-    // the physical pages may not be continuous
-    while (size > 0) {
-        int curr_size = (size > MEM_PAGE_SIZE) ? MEM_PAGE_SIZE : size;
-        uint32_t paddr = memory_get_paddr(page_dir, vaddr);
-        int ret = sys_read(file, (char*)paddr, curr_size);
-        if (ret < 0) {
-            log_printf("sys read failed");
-            return -1;
-        }
-        
-        size -= curr_size;
-        vaddr += curr_size;
+    if (phdr->p_flags & PF_W) {
+        prot |= PROT_WRITE;
+    }
+    if (phdr->p_flags & PF_X) {
+        prot |= PROT_EXEC;
     }
 
-    return 0;
+    return vma_map_image(task_current(), phdr->p_vaddr, phdr->p_memsz, prot,
+                         task_file(file), phdr->p_offset, phdr->p_filesz);
 }
 
-static uint32_t load_elf_file(task_t *task, const char *name, uint32_t page_dir) {
+static uint32_t load_elf_file(task_t *task, const char *name) {
     Elf32_Ehdr elf_hdr;
     Elf32_Phdr elf_phdr;
 
@@ -585,7 +698,7 @@ static uint32_t load_elf_file(task_t *task, const char *name, uint32_t page_dir)
     // e_phoff is the starting position of program header 0 
     uint32_t e_phoff = elf_hdr.e_phoff;
     for (int i = 0; i < elf_hdr.e_phnum; i++, e_phoff += elf_hdr.e_phentsize) {
-        if (sys_lseek(file, e_phoff, 0) < 0) {
+        if (sys_lseek(file, e_phoff, SEEK_SET) < 0) {
             log_printf("sys_lseek failed");
             goto load_elf_failed;
         }
@@ -600,7 +713,7 @@ static uint32_t load_elf_file(task_t *task, const char *name, uint32_t page_dir)
             continue;
         }
 
-        int ret = load_phdr(file, &elf_phdr, page_dir);
+        int ret = load_phdr(file, &elf_phdr);
         if (ret < 0) {
             log_printf("load program failed");
             goto load_elf_failed;
@@ -660,28 +773,56 @@ static int copy_args(char *to, uint32_t page_dir, int argc, char **argv) {
 // after exec the code and data will be completely replaced
 // child of fork does not go through the sys_fork code
 // execve does (it is changing itself)
+// name and argv are read after task->vmas is replaced by the new (empty) list,
+// a fault on them couldn't be handled then, so their pages are brought in first
+static void exec_prefault_args(const char *name, char **argv) {
+    vma_prefault_str(name);
+    if (!argv) {
+        return;
+    }
+
+    for (char **p = argv; ; p++) {
+        vma_prefault((uint32_t)p, sizeof(char*), 0);
+        if (!*p) {
+            break;
+        }
+        vma_prefault_str(*p);
+    }
+}
+
 int sys_execve(char *name, char **argv, char **env) {
     task_t *task = task_current();
+    uint64_t start_tsc = rdtsc();
+    exec_prefault_args(name, argv);
 
     kernel_strncpy(task->name, get_file_name(name), TASK_NAME_SIZE);
 
     uint32_t old_page_dir = task->tss.cr3;
+    // segments of new program are recorded in a new vma list,
+    // the old one is still needed if exec fails
+    vma_t *old_vmas = task->vmas;
+    task->vmas = (vma_t*)0;
 
     uint32_t new_page_dir = memory_create_uvm();
     if (!new_page_dir) {
         goto exec_failed;
     }
 
-    // this also sets up page tables
-    uint32_t entry = load_elf_file(task, name, new_page_dir);
-    if (!entry) {
+    // segments are loaded on demand after switching to new page dir
+    uint32_t entry = load_elf_file(task, name);
+    if (entry == -1) {
         goto exec_failed;
     }
 
+    // stack pages are allocated when touched, except the ones holding args
     uint32_t stack_top = MEM_TASK_STACK_TOP - MEM_TASK_ARG_SIZE;
-    int err = alloc_mem_for_task(
-        new_page_dir, MEM_TASK_STACK_SIZE / MEM_PAGE_SIZE,
-        MEM_TASK_STACK_TOP - MEM_TASK_STACK_SIZE, PTE_P | PTE_U | PTE_W
+    int err = vma_map_anon(task, MEM_TASK_STACK_TOP - MEM_TASK_STACK_SIZE, MEM_TASK_STACK_SIZE,
+                           PROT_READ | PROT_WRITE, 0);
+    if (err < 0) {
+        goto exec_failed;
+    }
+    err = alloc_mem_for_task(
+        new_page_dir, MEM_TASK_ARG_SIZE / MEM_PAGE_SIZE, stack_top, PTE_P | PTE_U | PTE_W
     );
     if (err < 0) {
         goto exec_failed;
@@ -701,14 +842,25 @@ int sys_execve(char *name, char **argv, char **env) {
     frame->esp = stack_top - sizeof(uint32_t) * SYSCALL_PARAM_COUNT;
     // cs ss are the same so not set
 
+    // mappings of the old address space are removed while it is still in use
+    vma_t *new_vmas = task->vmas;
+    task->vmas = old_vmas;
+    vma_destroy(task);
+    task->vmas = new_vmas;
+
     task->tss.cr3 = new_page_dir;
     // should set cr3 to change page dir immediately
     mmu_set_page_dir(new_page_dir);
-    // memory_destroy_uvm(old_page_dir); TODO: adding this line leads to error
+    // the old address space is not in use any more
+    memory_destroy_uvm(old_page_dir);
 
+    // the first instruction runs right after returning, its page is faulted in then
+    task->stat.exec_cycles = rdtsc() - start_tsc;
     return 0;
 
 exec_failed:
+    vma_discard(task);
+    task->vmas = old_vmas;
     if (new_page_dir) {
         memory_destroy_uvm(new_page_dir);
     }
@@ -728,14 +880,20 @@ file_t *task_file(int fd) {
     return file; 
 }
 
+// the lowest unused fd is returned as posix requires,
+// fd_map is checked 32 fds at a time
 int task_alloc_fd(file_t *file) {
     task_t *task = task_current();
-    for (int i = 0; i < OPEN_FILE_NUM; i++) {
-        if (task->file_table[i]) {
+    for (int i = 0; i < OPEN_FILE_NUM / 32; i++) {
+        uint32_t free_bits = ~task->fd_map[i];
+        if (!free_bits) {
             continue;
         }
-        task->file_table[i] = file;
-        return i;
+
+        int fd = i * 32 + __builtin_ctz(free_bits);
+        task->fd_map[i] |= 1 << (fd % 32);
+        task->file_table[fd] = file;
+        return fd;
     }
     
     return -1;
@@ -746,6 +904,7 @@ void task_remove_fd(int fd) {
         return;
     }
     task_current()->file_table[fd] = (file_t*)0;
+    task_current()->fd_map[fd / 32] &= ~(1 << (fd % 32));
     return;
 }
 
@@ -0,0 +1,512 @@
+#include "core/vma.h"
+#include "core/task.h"
+#include "core/memory.h"
+#include "cpu/mmu.h"
+#include "fs/fs.h"
+#include "fs/pcache.h"
+#include "tools/klib.h"
+#include "tools/log.h"
+#include <sys/fcntl.h>
+
+// vmas of a task are sorted by address in task->vmas[0, vma_count)
+// returns the index of the first vma ending above vaddr
+static int vma_search(task_t *task, uint32_t vaddr) {
+    int low = 0, high = task->vma_count;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (task->vmas[mid].end <= vaddr) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static vma_t *vma_find(task_t *task, uint32_t vaddr) {
+    int i = vma_search(task, vaddr);
+    if (i < task->vma_count && task->vmas[i].start <= vaddr) {
+        return task->vmas + i;
+    }
+    return (vma_t*)0;
+}
+
+// insert a vma for [start, end) at its sorted position, fails if overlapped
+static vma_t *vma_insert(task_t *task, uint32_t start, uint32_t end) {
+    if (start < MEM_TASK_BASE || end <= start) {
+        return (vma_t*)0;
+    }
+
+    if (!task->vmas) {
+        task->vmas = (vma_t*)mem_alloc_page(1);
+        if (!task->vmas) {
+            return (vma_t*)0;
+        }
+        task->vma_count = 0;
+    }
+
+    int i = vma_search(task, start);
+    if ((i < task->vma_count && task->vmas[i].start < end) || task->vma_count >= TASK_VMA_NUM) {
+        return (vma_t*)0;
+    }
+
+    for (int j = task->vma_count; j > i; j--) {
+        task->vmas[j] = task->vmas[j - 1];
+    }
+    task->vma_count++;
+
+    vma_t *vma = task->vmas + i;
+    kernel_memset(vma, 0, sizeof(vma_t));
+    vma->start = start;
+    vma->end = end;
+    return vma;
+}
+
+static void vma_delete(task_t *task, int i) {
+    task->vma_count--;
+    for (; i < task->vma_count; i++) {
+        task->vmas[i] = task->vmas[i + 1];
+    }
+}
+
+// find a free range of size bytes between MEM_TASK_MMAP_START and the stack
+static uint32_t vma_find_gap(task_t *task, uint32_t size) {
+    uint32_t start = MEM_TASK_MMAP_START;
+    uint32_t limit = MEM_TASK_STACK_TOP - MEM_TASK_STACK_SIZE;
+
+    // vmas are sorted, so the first hole after start large enough is used
+    for (int i = task->vmas ? vma_search(task, start) : 0; i < task->vma_count; i++) {
+        vma_t *vma = task->vmas + i;
+        if (vma->start >= start + size) {
+            break;
+        }
+        start = vma->end;
+    }
+
+    if (start + size > limit || start + size < start) {
+        return 0;
+    }
+    return start;
+}
+
+// unmap the pages [start, end) of vma, dirty pages of shared mappings are written back
+static void vma_unmap_pages(task_t *task, vma_t *vma, uint32_t start, uint32_t end) {
+    pde_t *page_dir = (pde_t*)task->tss.cr3;
+    for (uint32_t page = start; page < end && page >= start; page += MEM_PAGE_SIZE) {
+        if (!page_dir[pde_index(page)].present) {
+            // the whole page table is missing, move to the next one
+            page = down(page, MEM_PAGE_SIZE * PTE_CNT) + MEM_PAGE_SIZE * (PTE_CNT - 1);
+            continue;
+        }
+
+        pte_t *pte = find_pte(page_dir, page, 0);
+        if (!pte->present) {
+            continue;
+        }
+
+        uint32_t offset = vma->offset + page - vma->start;
+        if ((vma->flags & MAP_SHARED) && (pte->v & PTE_D) && offset < vma->file->size) {
+            // bytes beyond the end of file are not written, the file is never grown by mapping
+            int size = vma->file->size - offset;
+            if (size > MEM_PAGE_SIZE) {
+                size = MEM_PAGE_SIZE;
+            }
+            if (fs_write_at(vma->file, (char*)pte_paddr(pte), size, offset) < 0) {
+                log_printf("write back mapped page failed. addr: 0x%x", page);
+            }
+        }
+
+        // the page is still kept by page cache or other tasks if it's shared
+        memory_unmap_page(page_dir, page);
+    }
+
+    mmu_flush_tlb();
+}
+
+// remove [start, end) from the address space, vmas are cut if partially covered
+static int vma_remove(task_t *task, uint32_t start, uint32_t end) {
+    if (!task->vmas) {
+        return 0;
+    }
+
+    int i = vma_search(task, start);
+    while (i < task->vma_count && task->vmas[i].start < end) {
+        vma_t *vma = task->vmas + i;
+        if (start <= vma->start && end >= vma->end) {
+            vma_unmap_pages(task, vma, vma->start, vma->end);
+            if (vma->file) {
+                fs_close_file(vma->file);
+            }
+            vma_delete(task, i);
+            continue;
+        } else if (start <= vma->start) {
+            // head is removed
+            vma_unmap_pages(task, vma, vma->start, end);
+            vma->offset += end - vma->start;
+            vma->start = end;
+        } else if (end >= vma->end) {
+            // tail is removed
+            vma_unmap_pages(task, vma, start, vma->end);
+            vma->end = start;
+        } else {
+            // a hole in the middle, the vma is split into two
+            if (task->vma_count >= TASK_VMA_NUM) {
+                log_printf("no free vma for splitting");
+                return -1;
+            }
+
+            vma_unmap_pages(task, vma, start, end);
+            for (int j = task->vma_count; j > i + 1; j--) {
+                task->vmas[j] = task->vmas[j - 1];
+            }
+            task->vma_count++;
+
+            vma_t *tail = vma + 1;
+            *tail = *vma;
+            tail->start = end;
+            tail->offset += end - vma->start;
+            if (tail->file) {
+                file_inc_ref(tail->file);
+            }
+            vma->end = start;
+        }
+        i++;
+    }
+
+    return 0;
+}
+
+// the child of fork gets the same vmas, and the mapped pages are shared:
+// private writable pages become read-only in both tasks and are copied on the first write
+int vma_copy(task_t *from, task_t *to) {
+    if (!from->vmas) {
+        return 0;
+    }
+
+    to->vmas = (vma_t*)mem_alloc_page(1);
+    if (!to->vmas) {
+        return -1;
+    }
+    kernel_memcpy(to->vmas, from->vmas, from->vma_count * sizeof(vma_t));
+    to->vma_count = from->vma_count;
+
+    for (int i = 0; i < to->vma_count; i++) {
+        if (to->vmas[i].file) {
+            file_inc_ref(to->vmas[i].file);
+        }
+    }
+
+    // only the mapped ranges are walked, instead of the whole page dir
+    pde_t *page_dir = (pde_t*)from->tss.cr3;
+    for (int i = 0; i < from->vma_count; i++) {
+        vma_t *vma = from->vmas + i;
+        for (uint32_t page = vma->start; page < vma->end && page >= vma->start; page += MEM_PAGE_SIZE) {
+            if (!page_dir[pde_index(page)].present) {
+                page = down(page, MEM_PAGE_SIZE * PTE_CNT) + MEM_PAGE_SIZE * (PTE_CNT - 1);
+                continue;
+            }
+
+            pte_t *pte = find_pte(page_dir, page, 0);
+            if (!pte->present) {
+                continue;
+            }
+
+            if (!(vma->flags & MAP_SHARED)) {
+                pte->v &= ~PTE_W;
+            }
+            uint32_t paddr = pte_paddr(pte);
+            if (memory_create_map((pde_t*)to->tss.cr3, page, paddr, 1, pte->v & (PTE_U | PTE_W | PTE_SHARE)) < 0) {
+                mmu_flush_tlb();
+                return -1;
+            }
+            mem_page_ref(paddr);
+        }
+    }
+
+    mmu_flush_tlb();
+    return 0;
+}
+
+// remove all mappings, called when the address space is going away (exit, execve)
+void vma_destroy(task_t *task) {
+    if (!task->vmas) {
+        return;
+    }
+
+    vma_remove(task, 0, 0xFFFFFFFF);
+    mem_free_page((uint32_t)task->vmas, 1);
+    task->vmas = (vma_t*)0;
+    task->vma_count = 0;
+}
+
+// drop the vmas without touching page tables, the page dir is destroyed as a whole
+// (only for mappings without shared pages to write back, e.g. a failed execve or fork)
+void vma_discard(task_t *task) {
+    if (!task->vmas) {
+        return;
+    }
+
+    for (int i = 0; i < task->vma_count; i++) {
+        if (task->vmas[i].file) {
+            fs_close_file(task->vmas[i].file);
+        }
+    }
+    mem_free_page((uint32_t)task->vmas, 1);
+    task->vmas = (vma_t*)0;
+    task->vma_count = 0;
+}
+
+// map a segment of program: [vaddr, vaddr + filesz) comes from file at offset,
+// the rest up to vaddr + memsz is cleared. vaddr and offset have the same page offset
+int vma_map_image(task_t *task, uint32_t vaddr, uint32_t memsz, int prot,
+                  file_t *file, uint32_t offset, uint32_t filesz) {
+    vma_t *vma = vma_insert(task, down(vaddr, MEM_PAGE_SIZE), up(vaddr + memsz, MEM_PAGE_SIZE));
+    if (!vma) {
+        log_printf("map segment at 0x%x failed", vaddr);
+        return -1;
+    }
+
+    vma->prot = prot;
+    vma->flags = MAP_PRIVATE | VMA_IMAGE;
+    vma->file = file;
+    vma->offset = down(offset, MEM_PAGE_SIZE);
+    vma->file_end = vaddr + filesz;
+    file_inc_ref(file);
+    return 0;
+}
+
+// map zero filled pages (stack, heap...), start and size are page aligned
+int vma_map_anon(task_t *task, uint32_t start, uint32_t size, int prot, int flags) {
+    vma_t *vma = vma_insert(task, start, start + size);
+    if (!vma) {
+        log_printf("map 0x%x failed", start);
+        return -1;
+    }
+
+    vma->prot = prot;
+    vma->flags = MAP_PRIVATE | flags;
+    return 0;
+}
+
+// let the heap end at "end", it only grows
+int vma_set_heap(task_t *task, uint32_t start, uint32_t end) {
+    int i;
+    for (i = 0; i < task->vma_count; i++) {
+        if (task->vmas[i].flags & VMA_HEAP) {
+            break;
+        }
+    }
+
+    if (i == task->vma_count) {
+        return vma_map_anon(task, start, end - start, PROT_READ | PROT_WRITE, VMA_HEAP);
+    }
+
+    vma_t *heap = task->vmas + i;
+    if (end <= heap->end) {
+        return 0;
+    }
+    if (i + 1 < task->vma_count && task->vmas[i + 1].start < end) {
+        log_printf("heap runs into mapping at 0x%x", task->vmas[i + 1].start);
+        return -1;
+    }
+    heap->end = end;
+    return 0;
+}
+
+// get the cached page of file backing the page at vaddr
+static uint32_t vma_file_page(vma_t *vma, uint32_t page) {
+    uint32_t index = (vma->offset + page - vma->start) / MEM_PAGE_SIZE;
+    if (vma->flags & VMA_IMAGE) {
+        return pcache_get_exec(vma->file, index);
+    }
+    return pcache_get(vma->file, index);
+}
+
+// a private page filled with the file data before file_end, and zeroes after it
+static uint32_t vma_private_page(vma_t *vma, uint32_t page) {
+    // a page from the zeroed pool already has the zeroes after file_end
+    int zero = !vma->file || page + MEM_PAGE_SIZE > vma->file_end;
+    uint32_t paddr = zero ? mem_alloc_zero_page() : mem_alloc_page(1);
+    if (!paddr) {
+        return 0;
+    }
+
+    uint32_t size = 0;
+    if (vma->file && page < vma->file_end) {
+        uint32_t cached = vma_file_page(vma, page);
+        if (!cached) {
+            mem_free_page(paddr, 1);
+            return 0;
+        }
+
+        size = vma->file_end - page;
+        if (size > MEM_PAGE_SIZE) {
+            size = MEM_PAGE_SIZE;
+        }
+        kernel_memcpy((void*)paddr, (void*)cached, size);
+        mem_free_page(cached, 1);
+    }
+
+    return paddr;
+}
+
+// populate the page at vaddr if it is in a mapping, returns -1 if it is not a fault of mapping
+// private mappings copy the page on the first write (pages of page cache, or pages shared after fork)
+int vma_handle_fault(uint32_t vaddr, int write) {
+    task_t *task = task_current();
+    vma_t *vma = vma_find(task, vaddr);
+    if (!vma) {
+        return -1;
+    }
+
+    if (write && !(vma->prot & PROT_WRITE)) {
+        return -1;
+    }
+
+    uint32_t page = down(vaddr, MEM_PAGE_SIZE);
+    pte_t *pte = find_pte((pde_t*)task->tss.cr3, page, 1);
+    if (!pte) {
+        return -1;
+    }
+
+    if (pte->present) {
+        // only a write to a private page still shared with others gets here
+        if (!write || (vma->flags & MAP_SHARED)) {
+            return -1;
+        }
+
+        uint32_t paddr = pte_paddr(pte);
+        if (mem_page_refcount(paddr) > 1) {
+            uint32_t copy = mem_alloc_page(1);
+            if (!copy) {
+                return -1;
+            }
+            kernel_page_copy((void*)copy, (void*)paddr);
+            mem_free_page(paddr, 1);
+            paddr = copy;
+        }
+        // the last user of the page takes it over without copying
+        pte->v = paddr | PTE_P | PTE_U | PTE_W;
+        mmu_flush_tlb();
+        return 0;
+    }
+
+    // pages written by a private mapping, or partly beyond file_end (bss) are private,
+    // others are shared with page cache
+    uint32_t paddr;
+    uint32_t perm;
+    if (!vma->file || page + MEM_PAGE_SIZE > vma->file_end || (write && (vma->flags & MAP_PRIVATE))) {
+        paddr = vma_private_page(vma, page);
+        perm = PTE_U | ((vma->prot & PROT_WRITE) ? PTE_W : 0);
+    } else {
+        paddr = vma_file_page(vma, page);
+        perm = PTE_U | PTE_SHARE | (((vma->flags & MAP_SHARED) && (vma->prot & PROT_WRITE)) ? PTE_W : 0);
+    }
+    if (!paddr) {
+        log_printf("load mapped page failed. addr: 0x%x", vaddr);
+        return -1;
+    }
+
+    memory_set_pte(pte, paddr | PTE_P | perm);
+    mmu_flush_tlb();
+    return 0;
+}
+
+// populate the mapped pages of a user buffer before file system uses it,
+// otherwise faults in the middle of fs code would reenter the fs (and reuse its buffers)
+void vma_prefault(uint32_t start, int size, int write) {
+    task_t *task = task_current();
+    if (!task->vmas || size <= 0) {
+        return;
+    }
+
+    for (uint32_t page = down(start, MEM_PAGE_SIZE); page < start + size; page += MEM_PAGE_SIZE) {
+        pte_t *pte = find_pte((pde_t*)task->tss.cr3, page, 0);
+        if (pte && pte->present && (!write || (pte->v & PTE_W))) {
+            continue;
+        }
+        vma_handle_fault(page, write);
+    }
+}
+
+// same as vma_prefault, for a string of unknown length (e.g. path)
+void vma_prefault_str(const char *str) {
+    if (!task_current()->vmas) {
+        return;
+    }
+
+    uint32_t page = down((uint32_t)str, MEM_PAGE_SIZE);
+    while (1) {
+        vma_prefault(page, 1, 0);
+        if (!memory_get_paddr(task_current()->tss.cr3, page)) {
+            return;
+        }
+
+        // stop at the page holding the null char
+        const char *end = (const char*)(page + MEM_PAGE_SIZE);
+        for (; str < end; str++) {
+            if (*str == '\0') {
+                return;
+            }
+        }
+        page += MEM_PAGE_SIZE;
+    }
+}
+
+// map len bytes of file fd from offset, the address is chosen by kernel
+// prot is in the low byte of prot_flags and flags in the second byte (only 4 args for a syscall)
+// pages are populated on the first access, see vma_handle_fault
+int sys_mmap(uint32_t len, int prot_flags, int fd, uint32_t offset) {
+    int prot = prot_flags & 0xFF;
+    int flags = (prot_flags >> 8) & 0xFF;
+    if (!len || (offset & (MEM_PAGE_SIZE - 1))) {
+        log_printf("mmap: invalid len or offset");
+        return -1;
+    }
+    if ((flags & (MAP_SHARED | MAP_PRIVATE)) == 0 || (flags & (MAP_SHARED | MAP_PRIVATE)) == (MAP_SHARED | MAP_PRIVATE)) {
+        log_printf("mmap: either MAP_SHARED or MAP_PRIVATE is needed");
+        return -1;
+    }
+
+    file_t *file = task_file(fd);
+    if (!file || file->type != FILE_NORMAL) {
+        log_printf("mmap: fd %d is not a normal file", fd);
+        return -1;
+    }
+    if ((file->mode & O_WRONLY) || ((flags & MAP_SHARED) && (prot & PROT_WRITE) && !(file->mode & O_RDWR))) {
+        log_printf("mmap: file opened with wrong mode");
+        return -1;
+    }
+
+    task_t *task = task_current();
+    uint32_t size = up(len, MEM_PAGE_SIZE);
+    uint32_t start = vma_find_gap(task, size);
+    if (!start) {
+        log_printf("mmap: no space for %d bytes", len);
+        return -1;
+    }
+
+    vma_t *vma = vma_insert(task, start, start + size);
+    if (!vma) {
+        log_printf("mmap: too many mappings");
+        return -1;
+    }
+
+    vma->prot = prot;
+    vma->flags = flags;
+    vma->file = file;
+    vma->offset = offset;
+    vma->file_end = vma->end; // bytes beyond end of file are zeroes in cached pages
+    file_inc_ref(file); // the mapping is kept after fd is closed
+
+    return start;
+}
+
+int sys_munmap(void *addr, uint32_t len) {
+    uint32_t start = (uint32_t)addr;
+    if ((start & (MEM_PAGE_SIZE - 1)) || !len) {
+        return -1;
+    }
+
+    return vma_remove(task_current(), start, start + up(len, MEM_PAGE_SIZE));
+}
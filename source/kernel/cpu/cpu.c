@@ -5,6 +5,8 @@
 #include "ipc/mutex.h"
 #include "core/syscall.h"
 #include "core/task.h"
+#include "core/vma.h"
+#include "tools/trace.h"
 
 static mutex_t mutex;
 void exception_handler_syscall(void);
@@ -71,6 +73,7 @@ static void do_default_handler(exception_frame_t *frame, char *msg) {
     if (frame->cs & 0x3) {
         sys_exit(frame->error_code);
     } else {
+        log_flush(); // the log task won't run anymore
         for (;;) {
             hlt();
         }
@@ -159,6 +162,7 @@ void do_handler_general_protection(exception_frame_t * frame) {
     if (frame->cs & 0x3) {
         sys_exit(frame->error_code);
     } else {
+        log_flush(); // the log task won't run anymore
         for (;;) {
             hlt();
         }
@@ -166,14 +170,29 @@ void do_handler_general_protection(exception_frame_t * frame) {
 }
 
 void do_handler_page_fault(exception_frame_t * frame) {
+    // cr2 saves the address that exception occurs, it is read once before anything
+    // else runs, a fault taken while handling this one would overwrite it
+    uint32_t addr = read_cr2();
+    task_t *curr = task_current();
+    if (curr) {
+        curr->stat.faults++;
+    }
+
+    // pages of mapped files are populated on demand
+    trace_event(TRACE_PAGE_FAULT, TRACE_BEGIN, addr, frame->error_code);
+    int err = vma_handle_fault(addr, frame->error_code & ERR_PAGE_WR);
+    trace_event(TRACE_PAGE_FAULT, TRACE_END, addr, err);
+    if (err == 0) {
+        return;
+    }
+
     log_printf("--------------------");
     log_printf("IRQ/Exception happend: Page Fault");
 
     if (frame->error_code & ERR_PAGE_P) {
-        // cr2 saves the address that exception occurs
-        log_printf("Page-level protection violation: 0x%x.", read_cr2());
+        log_printf("Page-level protection violation: 0x%x.", addr);
     } else {
-        log_printf("Page is not present 0x%x", read_cr2());
+        log_printf("Page is not present 0x%x", addr);
    }
     
     if (frame->error_code & ERR_PAGE_WR) {
@@ -190,7 +209,15 @@ void do_handler_page_fault(exception_frame_t * frame) {
 	
     dump_core_regs(frame);
 
-     
+    // CS => CPL0, CPL3
+    if (frame->cs & 0x3) {
+        sys_exit(frame->error_code);
+    } else {
+        log_flush(); // the log task won't run anymore
+        for (;;) {
+            hlt();
+        }
+    }
 }
 
 void do_handler_fpu_error(exception_frame_t * frame) {
@@ -14,6 +14,7 @@
 #include "ipc/sem.h"
 #include "cpu/cpu.h"
 #include "tools/log.h"
+#include "core/memory.h"
 
 #define CONSOLE_NUM 8
 static console_t console_buf[CONSOLE_NUM];
@@ -44,32 +45,177 @@ static void update_cursor_pos(console_t *console) {
     irq_leave_protection(state);
 }
 
+// the text is drawn into the shadow buffer in ram, vga memory is only written by console_flush
+// the shadow is a ring of rows, screen row 0 is shadow row top_row
+static disp_char_t *row_start(console_t *console, int row) {
+    int r = (console->top_row + row) % console->disp_rows;
+    return console->shadow + r * console->disp_cols;
+}
+
+// scrollback: rows scrolled off the top are appended to a ring of bytes
+// a row with the default colors is stored as its chars only, others as the whole cells
+// every record is [type][data][type], the type at the end lets the ring be walked backwards
+#define SB_LINE_CHARS 0
+#define SB_LINE_CELLS 1
+
+static uint16_t default_attr(void) {
+    disp_char_t cell;
+    cell.v = 0;
+    cell.foreground = COLOR_WHITE;
+    cell.background = COLOR_BLACK;
+    return cell.v;
+}
+
+static int sb_record_size(console_t *console, uint8_t type) {
+    int data = (type == SB_LINE_CELLS) ? console->disp_cols * sizeof(disp_char_t) : console->disp_cols;
+    return data + 2;
+}
+
+static uint8_t sb_byte(console_t *console, int pos) {
+    return console->sb_buf[(pos + console->sb_size) % console->sb_size];
+}
+
+static void sb_write(console_t *console, const void *data, int size) {
+    const uint8_t *p = data;
+    for (int i = 0; i < size; i++) {
+        console->sb_buf[console->sb_tail] = p[i];
+        console->sb_tail = (console->sb_tail + 1) % console->sb_size;
+    }
+}
+
+// called with interrupts off (see console_write), console_scroll walks the ring from the irq
+static void sb_append(console_t *console, const disp_char_t *row) {
+    if (!console->sb_buf) {
+        return;
+    }
+
+    uint16_t attr = default_attr();
+    char chars[CONSOLE_COL];
+    uint8_t type = SB_LINE_CHARS;
+    for (int i = 0; i < console->disp_cols; i++) {
+        if ((row[i].v & 0xFF00) != attr) {
+            type = SB_LINE_CELLS;
+            break;
+        }
+        chars[i] = row[i].ch;
+    }
+
+    // the oldest rows make room
+    int size = sb_record_size(console, type);
+    while (console->sb_used + size > console->sb_size) {
+        int old = sb_record_size(console, sb_byte(console, console->sb_head));
+        console->sb_head = (console->sb_head + old) % console->sb_size;
+        console->sb_used -= old;
+        console->sb_lines--;
+    }
+
+    sb_write(console, &type, 1);
+    if (type == SB_LINE_CHARS) {
+        sb_write(console, chars, console->disp_cols);
+    } else {
+        sb_write(console, row, console->disp_cols * sizeof(disp_char_t));
+    }
+    sb_write(console, &type, 1);
+    console->sb_used += size;
+    console->sb_lines++;
+}
+
+// draw the record at pos into a row of vga memory, returns the position of the next record
+static int sb_show_line(console_t *console, int pos, disp_char_t *dest) {
+    uint8_t type = sb_byte(console, pos);
+    uint16_t attr = default_attr();
+    int data = pos + 1;
+    for (int i = 0; i < console->disp_cols; i++) {
+        if (type == SB_LINE_CHARS) {
+            dest[i].v = attr | (uint8_t)sb_byte(console, data + i);
+        } else {
+            int p = data + i * sizeof(disp_char_t);
+            dest[i].v = sb_byte(console, p) | (sb_byte(console, p + 1) << 8);
+        }
+    }
+    return (pos + sb_record_size(console, type)) % console->sb_size;
+}
+
+// show the screen moved view_offset rows back in history, the top rows come from
+// the scrollback and the rest from the shadow
+static void sb_show_view(console_t *console) {
+    int offset = console->view_offset;
+    int pos = console->sb_tail;
+    for (int i = 0; i < offset; i++) {
+        pos -= sb_record_size(console, sb_byte(console, pos - 1));
+        pos = (pos + console->sb_size) % console->sb_size;
+    }
+
+    for (int row = 0; row < console->disp_rows; row++) {
+        disp_char_t *dest = console->disp_base + row * console->disp_cols;
+        if (row < offset) {
+            pos = sb_show_line(console, pos, dest);
+        } else {
+            kernel_memcpy(dest, row_start(console, row - offset), console->disp_cols * sizeof(disp_char_t));
+        }
+    }
+}
+
+// end is included
+static void mark_dirty(console_t *console, int start, int end) {
+    for (int row = start; row <= end; row++) {
+        console->dirty_rows |= 1 << row;
+    }
+}
+
+// copy the changed rows to vga memory, only the console on the screen is copied
+// others keep their changes in the shadow until they are selected
+static void console_flush(console_t *console) {
+    if (console - console_buf != curr_console_idx) {
+        return;
+    }
+
+    // new output brings the view back to the live screen
+    if (console->view_offset) {
+        console->view_offset = 0;
+        mark_dirty(console, 0, console->disp_rows - 1);
+    }
+
+    // taken first, rows marked by console_select in between are copied by it
+    uint32_t dirty = console->dirty_rows;
+    console->dirty_rows = 0;
+    for (int row = 0; dirty; row++, dirty >>= 1) {
+        if (dirty & 1) {
+            kernel_memcpy(console->disp_base + row * console->disp_cols,
+                    row_start(console, row), console->disp_cols * sizeof(disp_char_t));
+        }
+    }
+}
+
 // end is included
 static void erase_rows(console_t *console, int start, int end) {
-    disp_char_t *ch_start = console->disp_base + console->disp_cols * start;
-    disp_char_t *ch_end = console->disp_base + console->disp_cols * (end + 1);
-    disp_char_t *p = ch_start;
-    for (; p < ch_end; p++) {
-        p->ch = ' ';
-        p->background = console->background;
-        p->foreground = console->foreground;
+    for (int row = start; row <= end; row++) {
+        disp_char_t *p = row_start(console, row);
+        for (int col = 0; col < console->disp_cols; col++, p++) {
+            p->ch = ' ';
+            p->background = console->background;
+            p->foreground = console->foreground;
+        }
     }
+    mark_dirty(console, start, end);
 }
 
+// no row is moved, the ring just starts later
+// the whole screen has to be copied again, but only once per flush
 static void scroll_up(console_t *console, int lines) {
-    disp_char_t *dest = console->disp_base;
-    disp_char_t *src = console->disp_base + lines * console->disp_cols;
-    uint32_t size = (console->disp_rows - lines) * console->disp_cols * sizeof(disp_char_t);
-    kernel_memcpy(dest, src, size);
-
+    for (int i = 0; i < lines; i++) {
+        sb_append(console, row_start(console, i));
+    }
+    console->top_row = (console->top_row + lines) % console->disp_rows;
     erase_rows(console, console->disp_rows - lines, console->disp_rows - 1);
+    mark_dirty(console, 0, console->disp_rows - 1);
     console->cursor_row -= lines;
 }
 
 static void move_forward(console_t *c, int steps) {
     c->cursor_col += steps;
     while (c->cursor_col >= c->disp_cols) {
-        if (c->cursor_row >= c->cursor_row - 1) {
+        if (c->cursor_row >= c->disp_rows - 1) {
             scroll_up(c, 1);
         } 
         c->cursor_col -= c->disp_cols;
@@ -110,14 +256,40 @@ static int back_chars(console_t *console, int n) {
 // this function does not change the cursor on the screen
 // we need to write to specific ports to change it
 static void show_char(console_t *console, char ch) {
-    int offset = console->cursor_col + console->cursor_row * console->disp_cols;
-    disp_char_t *p = console->disp_base + offset;
+    disp_char_t *p = row_start(console, console->cursor_row) + console->cursor_col;
+    mark_dirty(console, console->cursor_row, console->cursor_row);
     p->ch = ch;
     p->foreground = console->foreground;
     p->background = console->background;
     move_forward(console, 1);
 }
 
+// a run of printable chars, the same as show_char for each of them
+// but the cell is found only once per row
+static void show_chars(console_t *console, const char *str, int n) {
+    disp_char_t cell;
+    cell.v = 0;
+    cell.foreground = console->foreground;
+    cell.background = console->background;
+
+    while (n > 0) {
+        int count = console->disp_cols - console->cursor_col;
+        if (count > n) {
+            count = n;
+        }
+
+        disp_char_t *p = row_start(console, console->cursor_row) + console->cursor_col;
+        mark_dirty(console, console->cursor_row, console->cursor_row);
+        for (int i = 0; i < count; i++) {
+            cell.ch = *str++;
+            *p++ = cell;
+        }
+
+        n -= count;
+        move_forward(console, count);
+    }
+}
+
 static void erase_one_char(console_t *console) {
     if (back_chars(console, 1) < 0) {
         return;
@@ -127,15 +299,7 @@ static void erase_one_char(console_t *console) {
 }
 
 static void clear_display(console_t *console) {
-    int size = console->disp_rows * console->disp_cols;
-    disp_char_t *p = console->disp_base;
-    for (int i = 0; i < size; i++, p++) {
-        p->ch = ' ';
-        p->foreground = console->foreground;
-        p->background = console->background;
-    }
-
-    return;
+    erase_rows(console, 0, console->disp_rows - 1);
 }
 
 static void move_to_col0(console_t *console) {
@@ -163,7 +327,18 @@ int console_init(int idx) {
     console->foreground = COLOR_WHITE;
     console->background = COLOR_BLACK;
 
+    console->top_row = 0;
+    console->view_offset = 0;
+    if (!console->sb_buf) {
+        // history is kept when the tty is opened again
+        console->sb_buf = (uint8_t*)mem_alloc_page(CONSOLE_SCROLLBACK_PAGES);
+        console->sb_size = CONSOLE_SCROLLBACK_PAGES * MEM_PAGE_SIZE;
+        console->sb_head = console->sb_tail = console->sb_used = 0;
+        console->sb_lines = 0;
+    }
     if (idx == 0) {
+        // keep what is on the screen already (messages printed before the tty is opened)
+        kernel_memcpy(console->shadow, console->disp_base, sizeof(console->shadow));
         int cursor_pos = read_cursor_pos();
         console->cursor_row = cursor_pos / console->disp_cols;
         console->cursor_col = cursor_pos % console->disp_cols;
@@ -336,40 +511,74 @@ static void write_esc_seq(console_t *console, char ch) {
     }
 }
 
+static int is_printable(char ch) {
+    return (ch >= ' ') && (ch <= '~');
+}
+
+// everything in the output fifo is taken out in chunks and rendered
+// the hardware cursor is not moved here, see console_update_cursor
 int console_write(tty_t *tty) {
     console_t *c = console_buf + tty->console_idx;
+    char chunk[CONSOLE_CHUNK_SIZE];
 
     int len = 0;
     mutex_lock(&c->mutex);
     while (1) {
-        char ch;
-        int err = fifo_get(&tty->ofifo, &ch);
-        if (err < 0) {
+        int count = fifo_get_bulk(&tty->ofifo, chunk, sizeof(chunk));
+        if (count <= 0) {
             break;
         }
-        sem_notify(&tty->osem);
-        switch (c->write_state) {
-            case CONSOLE_WRITE_NORMAL:
-                write_normal_state(c, ch);
-                break;
-            case CONSOLE_WRITE_ESC:
-                write_esc_state(c, ch);
-                break;
-            case CONSOLE_WRITE_SEQ:
-                write_esc_seq(c, ch);
-            default:
-                break;
+        sem_notify_n(&tty->osem, count);
+
+        // console_scroll and console_select run in the keyboard irq and read the
+        // shadow, dirty_rows and the scrollback, c->mutex doesn't keep them out.
+        // a chunk is drawn with interrupts off, so they only see whole chunks
+        irq_state_t state = irq_enter_protection();
+        for (int i = 0; i < count; ) {
+            char ch = chunk[i];
+            if (c->write_state == CONSOLE_WRITE_NORMAL && is_printable(ch)) {
+                // most output is plain text, the whole run is drawn in one pass
+                int end = i + 1;
+                while (end < count && is_printable(chunk[end])) {
+                    end++;
+                }
+                show_chars(c, chunk + i, end - i);
+                i = end;
+                continue;
+            }
+
+            switch (c->write_state) {
+                case CONSOLE_WRITE_NORMAL:
+                    write_normal_state(c, ch);
+                    break;
+                case CONSOLE_WRITE_ESC:
+                    write_esc_state(c, ch);
+                    break;
+                case CONSOLE_WRITE_SEQ:
+                    write_esc_seq(c, ch);
+                default:
+                    break;
+            }
+            i++;
         }
+        irq_leave_protection(state);
 
-        len++;
+        len += count;
     }
+    irq_state_t state = irq_enter_protection();
+    console_flush(c);
+    irq_leave_protection(state);
     mutex_unlock(&c->mutex);
 
+    return len;
+}
+
+// move the hardware cursor to where the console of tty writes next
+// (only if the console is the one on the screen)
+void console_update_cursor(tty_t *tty) {
     if (curr_console_idx == tty->console_idx) {
-        update_cursor_pos(c);
+        update_cursor_pos(console_buf + tty->console_idx);
     }
-    
-    return len;
 }
 
 void console_close(int console) {
@@ -396,8 +605,41 @@ void console_select(int idx) {
     outb(0x3D4, 0xD);
     outb(0x3D5, (uint8_t)(pos & 0xFF));
 
+    // the shadow may have changed a lot while the console was in the background,
+    // it is copied as a whole
+    console->view_offset = 0;
+    mark_dirty(console, 0, console->disp_rows - 1);
+    console_flush(console);
     update_cursor_pos(console);
 
     // char num = idx + '0';
     // show_char(console, num);
-}
\ No newline at end of file
+}
+
+// move the view of the console on the screen back (lines > 0) or forward in the scrollback
+// called by the keyboard handler, only vga memory is written
+void console_scroll(int idx, int lines) {
+    if (idx != curr_console_idx) {
+        return;
+    }
+
+    console_t *console = console_buf + idx;
+    int offset = console->view_offset + lines;
+    if (offset > console->sb_lines) {
+        offset = console->sb_lines;
+    }
+    if (offset < 0) {
+        offset = 0;
+    }
+    if (offset == console->view_offset) {
+        return;
+    }
+
+    console->view_offset = offset;
+    if (offset == 0) {
+        mark_dirty(console, 0, console->disp_rows - 1);
+        console_flush(console);
+    } else {
+        sb_show_view(console);
+    }
+}
@@ -5,10 +5,12 @@
 
 extern dev_desc_t dev_tty_desc;
 extern dev_desc_t dev_disk_desc;
+extern dev_desc_t dev_serial_desc;
 
 static dev_desc_t *dev_desc_table[] = {
     &dev_tty_desc,
     &dev_disk_desc,
+    &dev_serial_desc,
 };
 
 static device_t dev_table[DEV_TABLE_SIZE];
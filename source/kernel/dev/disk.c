@@ -7,6 +7,7 @@
 #include "cpu/cpu.h"
 #include "ipc/mutex.h"
 #include "ipc/sem.h"
+#include "tools/trace.h"
 
 static disk_t disk_buf[DISK_NUM];
 static mutex_t disk_mutex;
@@ -229,6 +230,7 @@ int disk_read(device_t *dev, int start_sector, char *buf, int count) {
     curr_disk = disk;
     state = DISK_STATE_READ;
 
+    trace_event(TRACE_DISK_READ, TRACE_BEGIN, part->start_sector + start_sector, count);
     disk_send_cmd(disk, part->start_sector + start_sector, count, DISK_CMD_READ);
     for (int i = 0; i < count; i++) {
         if (task_current()) { // can't call sem_wait before os is prepared
@@ -237,6 +239,7 @@ int disk_read(device_t *dev, int start_sector, char *buf, int count) {
         int ret = disk_wait_data(disk);
         if (ret < 0) {
             log_printf("disk error during wait, device=%d", dev->minor);
+            trace_event(TRACE_DISK_READ, TRACE_END, part->start_sector + start_sector, -1);
             mutex_unlock(disk->mutex);
             return -1;
         }
@@ -245,6 +248,7 @@ int disk_read(device_t *dev, int start_sector, char *buf, int count) {
         buf += SECTOR_SIZE;
     }
 
+    trace_event(TRACE_DISK_READ, TRACE_END, part->start_sector + start_sector, count);
     mutex_unlock(disk->mutex);
     return count;
 }
@@ -266,6 +270,7 @@ int disk_write(device_t *dev, int start_sector, char *buf, int count) {
     curr_disk = disk;
     state = DISK_STATE_WRITE;
 
+    trace_event(TRACE_DISK_WRITE, TRACE_BEGIN, part->start_sector + start_sector, count);
     disk_send_cmd(disk, part->start_sector + start_sector, count, DISK_CMD_WRITE);
 
     for (int i = 0; i < count; i++) {
@@ -313,6 +318,7 @@ int disk_write(device_t *dev, int start_sector, char *buf, int count) {
     //         // sem_notify(disk->osem_empty); // notify by interrupt
     //     }
     // }
+    trace_event(TRACE_DISK_WRITE, TRACE_END, part->start_sector + start_sector, count);
     mutex_unlock(disk->mutex);
     return count;
 }
@@ -158,7 +158,28 @@ static void do_normal_key(uint8_t code) {
 static void do_e0_key(int code) {
     // this is used to deal with right ctrl and alt
     // but mac does not have these two 
-    // so leave it empty here
+    // so they are not handled here
+    int is_make = is_make_code(code);
+    char key = get_key(code);
+    if (!is_make) {
+        return;
+    }
+
+    // shift + page up/down moves through the scrollback by half a screen
+    switch (key) {
+        case KEY_PAGE_UP:
+            if (state_is_shift(&kbd_state)) {
+                tty_scroll(KBD_SCROLL_LINES);
+            }
+            break;
+        case KEY_PAGE_DOWN:
+            if (state_is_shift(&kbd_state)) {
+                tty_scroll(-KBD_SCROLL_LINES);
+            }
+            break;
+        default:
+            break;
+    }
 }
 
 static void do_e1_key(int code) {
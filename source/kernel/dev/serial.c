@@ -0,0 +1,208 @@
+#include "dev/serial.h"
+#include "dev/dev.h"
+#include "dev/tty.h"
+#include "cpu/cpu.h"
+#include "comm/cpu_instr.h"
+#include "tools/log.h"
+
+// 16550 uart with both fifos enabled
+// writers copy data into a ring and return, the transmit interrupt moves
+// the ring into the hardware fifo 16 bytes at a time, so nobody busy-waits for the line
+
+static serial_t serial_devs[SERIAL_NUM];
+
+static serial_t *get_serial(device_t *dev) {
+    int idx = dev->minor;
+    if (idx < 0 || idx >= SERIAL_NUM || (!dev->open_count)) {
+        log_printf("serial is not opened. serial=%d", idx);
+        return (serial_t*)0;
+    }
+
+    return serial_devs + idx;
+}
+
+// fill the hardware fifo from the ring, called with interrupts disabled
+// the transmit interrupt is enabled only while there is something left to send
+static void serial_tx(serial_t *serial) {
+    if (!(inb(serial->port + UART_LSR) & UART_LSR_THRE)) {
+        return; // the interrupt comes when the hardware fifo is empty
+    }
+
+    char buf[SERIAL_HW_FIFO_SIZE];
+    int count = fifo_get_bulk(&serial->ofifo, buf, sizeof(buf));
+    for (int i = 0; i < count; i++) {
+        outb(serial->port + UART_DATA, buf[i]);
+    }
+
+    if (count > 0) {
+        serial->tx_busy = 1;
+        outb(serial->port + UART_IER, UART_IER_RX | UART_IER_TX);
+        sem_notify_n(&serial->osem, count);
+    } else {
+        serial->tx_busy = 0;
+        outb(serial->port + UART_IER, UART_IER_RX);
+    }
+}
+
+int serial_open(device_t *dev) {
+    int idx = dev->minor;
+    if (idx < 0 || idx >= SERIAL_NUM) {
+        return -1;
+    }
+
+    serial_t *serial = serial_devs + idx;
+    serial->port = COM1_PORT;
+    fifo_init(&serial->ofifo, serial->obuf, SERIAL_OBUF_SIZE);
+    sem_init(&serial->osem, SERIAL_OBUF_SIZE);
+    fifo_init(&serial->ififo, serial->ibuf, SERIAL_IBUF_SIZE);
+    sem_init(&serial->isem, 0);
+    serial->tx_busy = 0;
+    serial->oflags = SERIAL_OCRLF;
+    serial->iflags = SERIAL_IECHO;
+
+    uint16_t port = serial->port;
+    outb(port + UART_IER, 0x00); // no interrupt while setting up
+    outb(port + UART_LCR, 0x80); // DLAB, to set the divisor
+    outb(port + UART_DATA, 0x01); // 115200 baud
+    outb(port + UART_IER, 0x00);
+    outb(port + UART_LCR, 0x03); // 8 bits, no parity, one stop bit
+    outb(port + UART_IIR, 0xC7); // enable and clear fifos, 14 bytes rx threshold
+    outb(port + UART_MCR, 0x0B); // DTR, RTS and OUT2 (OUT2 connects the interrupt line)
+    outb(port + UART_IER, UART_IER_RX);
+
+    irq_install(IRQ4_COM1, (irq_handler_t)exception_handler_serial);
+    irq_enable(IRQ4_COM1);
+    return 0;
+}
+
+// the same batching as tty_write: '\n' is expanded in a small buffer,
+// then the slots are reserved and copied into the ring at once
+int serial_write(device_t *dev, int addr, char *buf, int size) {
+    if (size < 0) {
+        return -1;
+    }
+
+    serial_t *serial = get_serial(dev);
+    if (!serial) {
+        return -1;
+    }
+
+    char batch[SERIAL_BATCH_SIZE];
+    int len = 0;
+    while (len < size) {
+        int count = 0;
+        while (len < size && count < SERIAL_BATCH_SIZE - 1) {
+            char c = buf[len++];
+            if (c == '\n' && (serial->oflags & SERIAL_OCRLF)) {
+                batch[count++] = '\r';
+            }
+            batch[count++] = c;
+        }
+
+        int put = 0;
+        while (put < count) {
+            int n = sem_wait_n(&serial->osem, count - put);
+            fifo_put_bulk(&serial->ofifo, batch + put, n);
+            put += n;
+
+            irq_state_t state = irq_enter_protection();
+            if (!serial->tx_busy) {
+                serial_tx(serial);
+            }
+            irq_leave_protection(state);
+        }
+    }
+
+    return len;
+}
+
+// waits for at least one char, then takes what has arrived
+// terminals send '\r' for enter, it is given to the reader as '\n'
+int serial_read(device_t *dev, int addr, char *buf, int size) {
+    if (size <= 0) {
+        return size < 0 ? -1 : 0;
+    }
+
+    serial_t *serial = get_serial(dev);
+    if (!serial) {
+        return -1;
+    }
+
+    int count = sem_wait_n(&serial->isem, size);
+    count = fifo_get_bulk(&serial->ififo, buf, count);
+    for (int i = 0; i < count; i++) {
+        if (buf[i] == '\r') {
+            buf[i] = '\n';
+        }
+    }
+
+    if (serial->iflags & SERIAL_IECHO) {
+        serial_write(dev, 0, buf, count);
+    }
+    return count;
+}
+
+int serial_control(device_t *dev, int cmd, int arg0, int arg1) {
+    serial_t *serial = get_serial(dev);
+    if (!serial) {
+        return -1;
+    }
+
+    switch (cmd) {
+        case TTY_CMD_ECHO:
+            if (arg0) {
+                serial->iflags |= SERIAL_IECHO;
+            } else {
+                serial->iflags &= ~SERIAL_IECHO;
+            }
+            break;
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+int serial_close(device_t *dev) {
+    return 0;
+}
+
+void do_handler_serial(exception_frame_t *frame) {
+    pic_send_eoi(IRQ4_COM1);
+
+    serial_t *serial = serial_devs;
+    uint8_t iir;
+    while (!((iir = inb(serial->port + UART_IIR)) & UART_IIR_NONE)) {
+        switch (iir & UART_IIR_ID_MASK) {
+            case UART_IIR_RX:
+            case UART_IIR_TIMEOUT:
+                while (inb(serial->port + UART_LSR) & UART_LSR_DATA) {
+                    char c = inb(serial->port + UART_DATA);
+                    // chars are dropped when nobody reads them
+                    if (fifo_put(&serial->ififo, c) == 0) {
+                        sem_notify(&serial->isem);
+                    }
+                }
+                break;
+            case UART_IIR_TX:
+                serial_tx(serial);
+                break;
+            case UART_IIR_LINE:
+                inb(serial->port + UART_LSR);
+                break;
+            default:
+                inb(serial->port + UART_MCR + 2); // modem status
+                break;
+        }
+    }
+}
+
+dev_desc_t dev_serial_desc = {
+    .name = "serial",
+    .major = DEV_SERIAL,
+    .open = serial_open,
+    .read = serial_read,
+    .write = serial_write,
+    .control = serial_control,
+    .close = serial_close,
+};
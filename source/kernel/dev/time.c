@@ -3,11 +3,17 @@
 #include "comm/cpu_instr.h"
 #include "os_cfg.h"
 #include "core/task.h"
+#include "tools/prof.h"
+#include "core/vma.h"
 
 static uint32_t sys_tick; // bss variables are always set to zero
+static int pit_rate = 1; // pit interrupts per os tick
+static int pit_count;
+static uint64_t start_tsc; // tsc when the timer started, sys_tick counts from here
 
-static void init_pit(void) {
-    uint32_t reload_count = PIT_OSC_FREQ / (1000.0 / OS_TICK_MS);
+// the pit interrupts rate times per os tick (only the profiler sets rate > 1)
+static void init_pit(int rate) {
+    uint32_t reload_count = PIT_OSC_FREQ * OS_TICK_MS / 1000 / rate;
 
     outb(PIT_COMMAND_MODE_PORT, PIT_CHANNLE0 | PIT_LOAD_LOHI | PIT_MODE3);
     outb(PIT_CHANNEL0_DATA_PORT, reload_count & 0xFF); // load the lower byte
@@ -15,6 +21,17 @@ static void init_pit(void) {
 }
 
 void do_handler_timer(exception_frame_t *frame) {
+    if (prof_enabled) {
+        prof_sample(frame);
+    }
+
+    // the os tick still happens every OS_TICK_MS when the pit runs faster
+    if (++pit_count < pit_rate) {
+        pic_send_eoi(IRQ0_TIMER);
+        return;
+    }
+    pit_count = 0;
+
     sys_tick++;
     pic_send_eoi(IRQ0_TIMER); 
 
@@ -24,9 +41,46 @@ void do_handler_timer(exception_frame_t *frame) {
     task_time_tick(); 
 }
 
+// called with interrupts disabled
+void time_set_rate(int rate) {
+    pit_rate = rate;
+    pit_count = 0;
+    init_pit(rate);
+}
+
+// tsc cycles since time_init, goes with time_get_ticks
+uint64_t time_get_tsc(void) {
+    return rdtsc() - start_tsc;
+}
+
+uint32_t time_get_ticks(void) {
+    return sys_tick;
+}
+
+// tsc and ticks taken together, the caller makes sure clock is mapped
+void time_read_clock(task_clock_t *clock) {
+    irq_state_t state = irq_enter_protection();
+    clock->tsc = time_get_tsc();
+    clock->ticks = sys_tick;
+    clock->tick_ms = OS_TICK_MS;
+    irq_leave_protection(state);
+}
+
+// user programs time things with the tsc, the ticks tell them how fast it runs
+int sys_get_clock(task_clock_t *clock) {
+    if (!clock) {
+        return -1;
+    }
+
+    vma_prefault((uint32_t)clock, sizeof(task_clock_t), 1);
+    time_read_clock(clock);
+    return 0;
+}
+
 void time_init(void) {
     sys_tick = 0;
-    init_pit();
+    start_tsc = rdtsc();
+    init_pit(pit_rate);
     irq_install(IRQ0_TIMER, exception_handler_timer);
     irq_enable(IRQ0_TIMER);
 }
\ No newline at end of file
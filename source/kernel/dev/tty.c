@@ -62,31 +62,32 @@ int tty_write(device_t *dev, int addr, char *buf, int size) {
         return -1;
     }
 
-    // actually the buffer here won't grow
+    // the data goes in batches instead of char by char
+    // '\n' is expanded to "\r\n" in a small buffer first, then the slots of
+    // the batch are reserved at once and it is copied into the fifo with memcpy
+    char batch[TTY_BATCH_SIZE];
     int len = 0;
-    while(size) {
-        char c = *buf++;
-
-        if (c == '\n' && (tty->oflags & TTY_OCRLF)) {
-            sem_wait(&tty->osem);
-            int err = fifo_put(&tty->ofifo, '\r');
-            if (err < 0) {
-                break;
+    while (len < size) {
+        int count = 0;
+        while (len < size && count < TTY_BATCH_SIZE - 1) {
+            char c = buf[len++];
+            if (c == '\n' && (tty->oflags & TTY_OCRLF)) {
+                batch[count++] = '\r';
             }
+            batch[count++] = c;
         }
 
-        sem_wait(&tty->osem);
-        int err = fifo_put(&tty->ofifo, c);
-        if (err < 0) {
-            break;
+        int put = 0;
+        while (put < count) {
+            int n = sem_wait_n(&tty->osem, count - put);
+            fifo_put_bulk(&tty->ofifo, batch + put, n);
+            put += n;
+            console_write(tty);
         }
-
-        len++;
-        size--;
-
-        console_write(tty);
     }
 
+    // the hardware cursor is moved once for the whole write
+    console_update_cursor(tty);
     return len;
 }
 
@@ -181,6 +182,11 @@ void tty_in(char c) {
     sem_notify(&tty_devs[curr_tty].isem_empty);
 }
 
+// move the view of the tty on the screen through its scrollback
+void tty_scroll(int lines) {
+    console_scroll(curr_tty, lines);
+}
+
 void tty_select(int idx) {
     if (idx < 0 || idx >= TTY_NUM) {
         log_printf("invalid tty index");
@@ -5,6 +5,12 @@
 #include "tools/log.h"
 
 static devfs_type_t devfs_type_list [] = {
+    // names are matched by prefix, so "ttyS" must come before "tty"
+    {
+        .name = "ttyS",
+        .dev_type = DEV_SERIAL,
+        .file_type = FILE_TTY,
+    },
     {
         .name = "tty",
         .dev_type = DEV_TTY,
@@ -78,7 +84,7 @@ void devfs_close(file_t *file) {
     dev_close(file->dev_id);
 }
 
-int devfs_seek(file_t *file, uint32_t offset, int dir) {
+int devfs_seek(file_t *file, int offset, int dir) {
     return -1;
 }
 
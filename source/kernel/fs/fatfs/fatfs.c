@@ -5,8 +5,205 @@
 #include "core/memory.h"
 #include "os_cfg.h"
 #include "tools/klib.h"
+#include "fs/pcache.h"
+#include "fs/pathcache.h"
 #include <sys/fcntl.h>
 
+#define FAT_CMAP_SIZE (MEM_PAGE_SIZE / sizeof(uint16_t)) // clusters in a file cluster map
+
+// load the whole fat table into memory and build the free cluster bitmap
+// the table, the free bitmap and the dirty bitmap share the same pages
+static int fat_table_load(fat_t *fat, dbr_t *dbr, int dev_id) {
+    uint32_t total_sectors = dbr->BPB_TotSec16 ? dbr->BPB_TotSec16 : dbr->BPB_TotSec32;
+    uint32_t tbl_bytes = fat->tbl_sectors * fat->bytes_per_sec;
+    // the table may be larger than the number of clusters in data area
+    fat->cluster_cnt = (total_sectors - fat->data_start) / fat->sec_per_cluster + 2;
+    if (fat->cluster_cnt > tbl_bytes / sizeof(uint16_t)) {
+        fat->cluster_cnt = tbl_bytes / sizeof(uint16_t);
+    }
+
+    uint32_t free_bytes = bitmap_byte_count(fat->cluster_cnt);
+    uint32_t dirty_bytes = bitmap_byte_count(fat->tbl_sectors);
+    fat->fat_page_count = up(tbl_bytes + free_bytes + dirty_bytes, MEM_PAGE_SIZE) / MEM_PAGE_SIZE;
+    uint8_t *buf = (uint8_t*)mem_alloc_page(fat->fat_page_count);
+    if (!buf) {
+        log_printf("mem alloc page for fat table failed");
+        return -1;
+    }
+
+    int ret = dev_read(dev_id, fat->tbl_start, (char*)buf, fat->tbl_sectors);
+    if (ret != fat->tbl_sectors) {
+        log_printf("read fat table failed");
+        mem_free_page((uint32_t)buf, fat->fat_page_count);
+        return -1;
+    }
+
+    fat->fat_table = (uint16_t*)buf;
+    bitmap_init(&fat->free_bitmap, buf + tbl_bytes, fat->cluster_cnt, 0);
+    bitmap_init(&fat->dirty_bitmap, buf + tbl_bytes + free_bytes, fat->tbl_sectors, 0);
+
+    fat->free_cnt = 0;
+    for (int i = 2; i < fat->cluster_cnt; i++) {
+        if (fat->fat_table[i] == FAT_CLUSTER_FREE) {
+            bitmap_set_bit(&fat->free_bitmap, i, 1, 1);
+            fat->free_cnt++;
+        }
+    }
+    fat->next_free = 2;
+
+    return 0;
+}
+
+// write the modified fat sectors back to every copy of fat table (tbl_cnt)
+// adjacent dirty sectors are written with one disk command
+static int fat_table_flush(fat_t *fat) {
+    int sector = bitmap_find_bit(&fat->dirty_bitmap, 1, 0);
+    while (sector >= 0) {
+        int end = bitmap_find_bit(&fat->dirty_bitmap, 0, sector);
+        if (end < 0) {
+            end = fat->tbl_sectors;
+        }
+
+        int count = end - sector;
+        char *buf = (char*)fat->fat_table + sector * fat->bytes_per_sec;
+        for (int i = 0; i < fat->tbl_cnt; i++) {
+            int ret = dev_write(fat->fs->dev_id, fat->tbl_start + i * fat->tbl_sectors + sector, buf, count);
+            if (ret != count) {
+                log_printf("write fat table failed");
+                return -1;
+            }
+        }
+
+        bitmap_set_bit(&fat->dirty_bitmap, sector, count, 0);
+        sector = bitmap_find_bit(&fat->dirty_bitmap, 1, end);
+    }
+
+    return 0;
+}
+
+static uint32_t dir_name_hash(const uint8_t *name) {
+    uint32_t hash = 0;
+    for (int i = 0; i < FORMAT_NAME_LEN; i++) {
+        hash = hash * 31 + name[i];
+    }
+    return hash % FAT_DIR_HASH_SIZE;
+}
+
+static void root_index_add(fat_t *fat, int index, diritem_t *item) {
+    fat_dent_t *dent = fat->root_index + index;
+    kernel_memcpy(dent->name, item->DIR_Name, FORMAT_NAME_LEN);
+    dent->cluster = item->DIR_FstClusL0;
+    dent->attr = item->DIR_Attr;
+    dent->used = 1;
+
+    uint32_t hash = dir_name_hash(dent->name);
+    dent->next = fat->root_hash[hash];
+    fat->root_hash[hash] = index;
+    bitmap_set_bit(&fat->root_free, index, 1, 0);
+}
+
+static void root_index_remove(fat_t *fat, int index) {
+    fat_dent_t *dent = fat->root_index + index;
+    short *link = fat->root_hash + dir_name_hash(dent->name);
+    while (*link >= 0) {
+        if (*link == index) {
+            *link = dent->next;
+            break;
+        }
+        link = &fat->root_index[*link].next;
+    }
+
+    dent->used = 0;
+    dent->next = -1;
+    bitmap_set_bit(&fat->root_free, index, 1, 1);
+}
+
+// called whenever a root directory entry is written to disk
+static void root_index_update(fat_t *fat, int index, diritem_t *item) {
+    if (fat->root_index[index].used) {
+        root_index_remove(fat, index);
+    }
+    if (item->DIR_Name[0] != DIRITEM_NAME_END && item->DIR_Name[0] != DIRITEM_NAME_FREE) {
+        root_index_add(fat, index, item);
+    }
+}
+
+// returns the slot of the formatted name, -1 if not found
+static int root_index_find(fat_t *fat, const uint8_t *format_name) {
+    int index = fat->root_hash[dir_name_hash(format_name)];
+    while (index >= 0) {
+        fat_dent_t *dent = fat->root_index + index;
+        if (kernel_memcmp(dent->name, format_name, FORMAT_NAME_LEN) == 0) {
+            return index;
+        }
+        index = dent->next;
+    }
+    return -1;
+}
+
+// the lowest free slot, so the entries stay before the end mark
+static int root_index_alloc(fat_t *fat) {
+    return bitmap_find_bit(&fat->root_free, 1, 0);
+}
+
+// scan the root directory once, a page at a time through fat_buffer
+static int root_index_build(fat_t *fat) {
+    uint32_t index_bytes = fat->root_ent_cnt * sizeof(fat_dent_t);
+    uint32_t hash_bytes = FAT_DIR_HASH_SIZE * sizeof(short);
+    uint32_t free_bytes = bitmap_byte_count(fat->root_ent_cnt);
+    fat->root_page_count = up(index_bytes + hash_bytes + free_bytes, MEM_PAGE_SIZE) / MEM_PAGE_SIZE;
+    uint8_t *buf = (uint8_t*)mem_alloc_page(fat->root_page_count);
+    if (!buf) {
+        log_printf("mem alloc page for root index failed");
+        return -1;
+    }
+
+    fat->root_index = (fat_dent_t*)buf;
+    fat->root_hash = (short*)(buf + index_bytes);
+    // every slot is free until it is found in use
+    bitmap_init(&fat->root_free, buf + index_bytes + hash_bytes, fat->root_ent_cnt, 1);
+    for (int i = 0; i < fat->root_ent_cnt; i++) {
+        fat->root_index[i].used = 0;
+        fat->root_index[i].next = -1;
+    }
+    for (int i = 0; i < FAT_DIR_HASH_SIZE; i++) {
+        fat->root_hash[i] = -1;
+    }
+
+    int items_per_page = MEM_PAGE_SIZE / sizeof(diritem_t);
+    int sectors_per_page = MEM_PAGE_SIZE / fat->bytes_per_sec;
+    int root_sectors = fat->root_ent_cnt * sizeof(diritem_t) / fat->bytes_per_sec;
+    for (int sector = 0; sector < root_sectors; sector += sectors_per_page) {
+        int count = root_sectors - sector;
+        if (count > sectors_per_page) {
+            count = sectors_per_page;
+        }
+        int ret = dev_read(fat->fs->dev_id, fat->root_start + sector, fat->fat_buffer, count);
+        if (ret != count) {
+            log_printf("read root directory failed");
+            fat->sector_idx = -1;
+            mem_free_page((uint32_t)buf, fat->root_page_count);
+            return -1;
+        }
+
+        int base = sector * fat->bytes_per_sec / sizeof(diritem_t);
+        for (int i = 0; i < items_per_page && base + i < fat->root_ent_cnt; i++) {
+            diritem_t *item = (diritem_t*)fat->fat_buffer + i;
+            if (item->DIR_Name[0] == DIRITEM_NAME_END) {
+                // nothing is used after the end mark
+                fat->sector_idx = -1;
+                return 0;
+            }
+            if (item->DIR_Name[0] != DIRITEM_NAME_FREE) {
+                root_index_add(fat, base + i, item);
+            }
+        }
+    }
+
+    fat->sector_idx = -1;
+    return 0;
+}
+
 int fatfs_mount(struct _fs_t *fs, int major, int minor) {
     int dev_id = dev_open(major, minor, (void*)0);
     if (dev_id < 0) {
@@ -54,7 +251,28 @@ int fatfs_mount(struct _fs_t *fs, int major, int minor) {
         goto mount_failed;
     }
 
+    ret = fat_table_load(fat, dbr, dev_id);
+    if (ret < 0) {
+        goto mount_failed;
+    }
+
     fs->dev_id = dev_id;
+    ret = root_index_build(fat);
+    if (ret < 0) {
+        mem_free_page((uint32_t)fat->fat_table, fat->fat_page_count);
+        goto mount_failed;
+    }
+
+    // all entries start invalid
+    fat->dcache = (fat_dcache_t*)mem_alloc_page(1);
+    if (!fat->dcache) {
+        log_printf("mem alloc page for dir cache failed");
+        mem_free_page((uint32_t)fat->root_index, fat->root_page_count);
+        mem_free_page((uint32_t)fat->fat_table, fat->fat_page_count);
+        goto mount_failed;
+    }
+    kernel_page_zero(fat->dcache);
+
     fs->data = &fs->fat_data;
 
     return 0;
@@ -71,7 +289,11 @@ mount_failed:
 
 void fatfs_unmount(struct _fs_t *fs) {
     fat_t *fat = (fat_t*)fs->data;
+    fat_table_flush(fat);
     dev_close(fs->dev_id);
+    mem_free_page((uint32_t)fat->fat_table, fat->fat_page_count);
+    mem_free_page((uint32_t)fat->root_index, fat->root_page_count);
+    mem_free_page((uint32_t)fat->dcache, 1);
     mem_free_page((uint32_t)fat->fat_buffer, 1);
 }
 
@@ -90,16 +312,74 @@ static file_type_t diritem_get_type(diritem_t *item) {
     }
 }
 
-static void read_item_to_file(fat_t *fat, diritem_t *item, file_t *file, int index) {
+// get the next cluster number from the in-memory fat table
+uint16_t cluster_get_next(fat_t *fat, int curr_block) {
+    if (curr_block < 2 || curr_block >= fat->cluster_cnt) {
+        return FAT_CLUSTER_INVALID;
+    }
+
+    return fat->fat_table[curr_block];
+}
+
+int cluster_invalid(uint16_t cluster) {
+    if (cluster >= FAT_CLUSTER_INVALID || cluster < 2) {
+        return 1;
+    }
+    return 0;
+}
+
+static void read_item_to_file(fat_t *fat, diritem_t *item, file_t *file, uint16_t dir, int index) {
     file->type = diritem_get_type(item);
     file->size = item->DIR_FileSize;
     file->pos = 0;
+    file->p_dir = dir;
     file->p_index = index;
+    file->ino = FAT_INO(dir, index);
     file->sblk = (item->DIR_FstClusHI << 16) | item->DIR_FstClusL0;
     file->cblk = file->sblk;
 }
 
-static int read_dir_entry(fat_t *fat, int index, diritem_t *item) {
+// a subdirectory is stored as a cluster chain of diritem_t
+// the cluster holding the entry is loaded into fat_buffer as a whole,
+// the same way fatfs_read buffers a cluster, so sector_idx stays meaningful for both
+// returns the offset of the entry in fat_buffer, -1 if the index is beyond the chain
+static int subdir_load_entry(fat_t *fat, uint16_t dir, int index) {
+    int per_cluster = fat->cluster_byte_size / sizeof(diritem_t);
+    if (index < 0) {
+        return -1;
+    }
+
+    uint16_t cluster = dir;
+    for (int i = index / per_cluster; i > 0 && !cluster_invalid(cluster); i--) {
+        cluster = cluster_get_next(fat, cluster);
+    }
+    if (cluster_invalid(cluster)) {
+        return -1;
+    }
+
+    int sector_idx = fat->data_start + fat->sec_per_cluster * (cluster - 2);
+    if (fat->sector_idx != sector_idx) {
+        int ret = dev_read(fat->fs->dev_id, sector_idx, fat->fat_buffer, fat->sec_per_cluster);
+        if (ret != fat->sec_per_cluster) {
+            fat->sector_idx = -1;
+            return -1;
+        }
+        fat->sector_idx = sector_idx;
+    }
+
+    return (index % per_cluster) * sizeof(diritem_t);
+}
+
+static int read_dir_entry(fat_t *fat, uint16_t dir, int index, diritem_t *item) {
+    if (dir != FAT_ROOT_DIR) {
+        int offset = subdir_load_entry(fat, dir, index);
+        if (offset < 0) {
+            return -1;
+        }
+        kernel_memcpy(item, fat->fat_buffer + offset, sizeof(diritem_t));
+        return 0;
+    }
+
     if (index < 0 || index >= fat->root_ent_cnt) {
         log_printf("invalid dir index");
         return -1;
@@ -124,9 +404,21 @@ static int read_dir_entry(fat_t *fat, int index, diritem_t *item) {
     return 0;
 }
 
+// only the first component of path is formatted, it stops at '/'
 static void to_format_name (const char *path, char *format_name) {
+    kernel_memset(format_name, ' ', FORMAT_NAME_LEN);
+    // "." and ".." are stored as they are in subdirectories
+    if (path[0] == '.' && (path[1] == '\0' || path[1] == '/')) {
+        format_name[0] = '.';
+        return;
+    }
+    if (path[0] == '.' && path[1] == '.' && (path[2] == '\0' || path[2] == '/')) {
+        format_name[0] = format_name[1] = '.';
+        return;
+    }
+
     int i = 0;
-    while (*path) {
+    while (*path && *path != '/') {
         if (*path == '.') {
             for (int j = i; j < 8; j++) {
                 format_name[j] = ' ';
@@ -152,7 +444,26 @@ int diritem_name_match(const char *path, diritem_t *item) {
     return kernel_memcmp(item->DIR_Name, buf, FORMAT_NAME_LEN) == 0;
 }
 
-static int write_dir_entry(fat_t *fat, diritem_t *item, int index) {
+static void dcache_update(fat_t *fat, uint16_t dir, int index, diritem_t *item);
+
+static int write_dir_entry(fat_t *fat, diritem_t *item, uint16_t dir, int index) {
+    if (dir != FAT_ROOT_DIR) {
+        int offset = subdir_load_entry(fat, dir, index);
+        if (offset < 0) {
+            return -1;
+        }
+        kernel_memcpy(fat->fat_buffer + offset, item, sizeof(diritem_t));
+        // only the sector holding the entry is written back
+        int sector = offset / fat->bytes_per_sec;
+        int ret = dev_write(fat->fs->dev_id, fat->sector_idx + sector, 
+                    fat->fat_buffer + sector * fat->bytes_per_sec, 1);
+        if (ret != 1) {
+            return -1;
+        }
+        dcache_update(fat, dir, index, item);
+        return 0;
+    }
+
     if (index < 0 || index >= fat->root_ent_cnt) {
         log_printf("invalid dir index");
         return -1;
@@ -169,6 +480,7 @@ static int write_dir_entry(fat_t *fat, diritem_t *item, int index) {
         if (ret != 1) {
             return -1;
         }
+        root_index_update(fat, index, item);
         return 0;
     }
 
@@ -187,11 +499,12 @@ static int write_dir_entry(fat_t *fat, diritem_t *item, int index) {
     if (ret != 1) {
         return -1;
     }
+    root_index_update(fat, index, item);
     return 0;
 }
 
-static void diritem_init(diritem_t *item, uint8_t attr, const char *name) {
-    to_format_name(name, item->DIR_Name);
+static void diritem_init(diritem_t *item, uint8_t attr, const uint8_t *format_name) {
+    kernel_memcpy(item->DIR_Name, format_name, FORMAT_NAME_LEN);
     item->DIR_FstClusHI = 0; // since cluster index is only 16 bits long
     item->DIR_FstClusL0 = (uint16_t)(FAT_CLUSTER_INVALID & 0xFFFF);
     item->DIR_FileSize = 0;
@@ -204,62 +517,151 @@ static void diritem_init(diritem_t *item, uint8_t attr, const char *name) {
     item->DIR_LastAccDate = item->DIR_CrtDate;
 }
 
-static int cluster_set_next(fat_t *fat, uint16_t cluster_num, uint16_t next) {
-    int offset = cluster_num * sizeof(uint16_t);
-    int sector_idx = fat->tbl_start + offset / fat->bytes_per_sec;
-    int sector_offset = offset % fat->bytes_per_sec;
+static fat_dcache_t *dcache_slot(fat_t *fat, uint16_t dir, const uint8_t *format_name) {
+    uint32_t hash = dir;
+    for (int i = 0; i < FORMAT_NAME_LEN; i++) {
+        hash = hash * 31 + format_name[i];
+    }
+    return fat->dcache + hash % (MEM_PAGE_SIZE / sizeof(fat_dcache_t));
+}
 
-    // hit
-    if (fat->sector_idx == sector_idx) {
-        *(uint16_t*)(fat->fat_buffer + sector_offset) = next;
-        int ret = dev_write(fat->fs->dev_id, sector_idx, fat->fat_buffer, 1);
-        if (ret < 0) {
-            return ret;
+static void dcache_fill(fat_t *fat, uint16_t dir, const uint8_t *format_name, int index, diritem_t *item) {
+    fat_dcache_t *d = dcache_slot(fat, dir, format_name);
+    kernel_memcpy(d->name, format_name, FORMAT_NAME_LEN);
+    d->dir = dir;
+    d->index = index;
+    d->attr = item ? item->DIR_Attr : 0;
+    d->cluster = item ? item->DIR_FstClusL0 : FAT_CLUSTER_INVALID;
+    d->valid = 1;
+}
+
+// called whenever a subdirectory entry is written to disk
+// the old name at the slot is dropped and the new one (if used) is cached,
+// which also replaces a negative entry of the same name
+static void dcache_update(fat_t *fat, uint16_t dir, int index, diritem_t *item) {
+    for (int i = 0; i < MEM_PAGE_SIZE / sizeof(fat_dcache_t); i++) {
+        fat_dcache_t *d = fat->dcache + i;
+        if (d->valid && d->dir == dir && d->index == index) {
+            d->valid = 0;
         }
-        return 0;
     }
 
-    // miss
-    // read from disk 
-    int ret = dev_read(fat->fs->dev_id, sector_idx, fat->fat_buffer, 1);
-    if (ret < 0) {
-        return ret;
+    if (item->DIR_Name[0] != DIRITEM_NAME_END && item->DIR_Name[0] != DIRITEM_NAME_FREE) {
+        dcache_fill(fat, dir, item->DIR_Name, index, item);
     }
-    fat->sector_idx = sector_idx;
+}
 
-    // write buffer, write disk
-    *(uint16_t*)(fat->fat_buffer + sector_offset) = next;
-    ret = dev_write(fat->fs->dev_id, sector_idx, fat->fat_buffer, 1);
-    if (ret < 0) {
-        return ret;
+// find the formatted name in a directory, returns the index or -1 if not found
+// the cluster and attribute of the entry are also returned, so walking a path
+// doesn't need to read the entries of the intermediate directories again
+static int dir_find_entry(fat_t *fat, uint16_t dir, const uint8_t *format_name, uint16_t *cluster, uint8_t *attr) {
+    if (dir == FAT_ROOT_DIR) {
+        int index = root_index_find(fat, format_name);
+        if (index >= 0) {
+            *cluster = fat->root_index[index].cluster;
+            *attr = fat->root_index[index].attr;
+        }
+        return index;
     }
 
-    return 0;
-}
+    fat_dcache_t *d = dcache_slot(fat, dir, format_name);
+    if (d->valid && d->dir == dir && kernel_memcmp(d->name, format_name, FORMAT_NAME_LEN) == 0) {
+        *cluster = d->cluster;
+        *attr = d->attr;
+        return d->index;
+    }
 
-// read the corresponding sector to fat buffer 
-// and get the next cluster number
-uint16_t cluster_get_next(fat_t *fat, int curr_block) {
-    // an entry is 16 bit long
-    int offset = curr_block * sizeof(uint16_t);
-    int sector_idx = fat->tbl_start + offset / fat->bytes_per_sec;
-    if (fat->sector_idx == sector_idx) {
-        return *(uint16_t*)(fat->fat_buffer + offset % fat->bytes_per_sec); 
+    // cache miss, scan the directory cluster by cluster
+    diritem_t item;
+    for (int i = 0; read_dir_entry(fat, dir, i, &item) == 0; i++) {
+        if (item.DIR_Name[0] == DIRITEM_NAME_END) {
+            break;
+        }
+        if (item.DIR_Name[0] == DIRITEM_NAME_FREE) {
+            continue;
+        }
+        if (kernel_memcmp(item.DIR_Name, format_name, FORMAT_NAME_LEN) == 0) {
+            dcache_fill(fat, dir, format_name, i, &item);
+            *cluster = item.DIR_FstClusL0;
+            *attr = item.DIR_Attr;
+            return i;
+        }
     }
 
-    int ret = dev_read(fat->fs->dev_id, sector_idx, fat->fat_buffer, 1);
-    if (ret < 0) {
+    // remember that the name is not there
+    dcache_fill(fat, dir, format_name, -1, (diritem_t*)0);
+    return -1;
+}
+
+// walk the path from root directory, e.g. "a/b/c.txt"
+// dir is set to the directory holding the last component, format_name to the formatted last component
+// and index to its index in dir (-1 if it doesn't exist yet)
+// returns -1 if a directory in the middle of the path doesn't exist
+static int fat_lookup(fat_t *fat, const char *path, uint16_t *dir, int *index, uint8_t *format_name) {
+    uint16_t curr = FAT_ROOT_DIR;
+    while (*path == '/') {
+        path++;
+    }
+    if (!*path) {
         return -1;
     }
 
-    fat->sector_idx = sector_idx;
-    return *(uint16_t*)(fat->fat_buffer + offset % fat->bytes_per_sec);
+    while (1) {
+        const char *next = path;
+        while (*next && *next != '/') {
+            next++;
+        }
+        while (*next == '/') {
+            next++;
+        }
+
+        uint16_t cluster;
+        uint8_t attr;
+        to_format_name(path, format_name);
+        int i = dir_find_entry(fat, curr, format_name, &cluster, &attr);
+        if (!*next) {
+            *dir = curr;
+            *index = i;
+            return 0;
+        }
+
+        if (i < 0 || !(attr & DIRITEM_ATTR_DIRECTORY)) {
+            return -1;
+        }
+        // ".." of a directory under root has cluster 0, which is FAT_ROOT_DIR
+        curr = cluster;
+        path = next;
+    }
 }
 
-int cluster_invalid(uint16_t cluster) {
-    if (cluster >= FAT_CLUSTER_INVALID || cluster < 2) {
-        return 1;
+// only the in-memory table is modified here,
+// the sector is marked dirty and written back by fat_table_flush
+static int cluster_set_next(fat_t *fat, uint16_t cluster_num, uint16_t next) {
+    if (cluster_num < 2 || cluster_num >= fat->cluster_cnt) {
+        log_printf("invalid cluster number: %d", cluster_num);
+        return -1;
     }
+
+    uint16_t prev = fat->fat_table[cluster_num];
+    fat->fat_table[cluster_num] = next;
+
+    // keep free bitmap in sync with the table
+    if (prev == FAT_CLUSTER_FREE && next != FAT_CLUSTER_FREE) {
+        bitmap_set_bit(&fat->free_bitmap, cluster_num, 1, 0);
+        fat->free_cnt--;
+    } else if (prev != FAT_CLUSTER_FREE && next == FAT_CLUSTER_FREE) {
+        bitmap_set_bit(&fat->free_bitmap, cluster_num, 1, 1);
+        fat->free_cnt++;
+        if (cluster_num < fat->next_free) {
+            fat->next_free = cluster_num;
+        }
+    }
+
+    int sector = cluster_num * sizeof(uint16_t) / fat->bytes_per_sec;
+    if (!bitmap_is_set(&fat->dirty_bitmap, sector)) {
+        bitmap_set_bit(&fat->dirty_bitmap, sector, 1, 1);
+    }
+
     return 0;
 }
 
@@ -276,50 +678,128 @@ static int cluster_free_chain(fat_t *fat, uint16_t cluster_num) {
     return 0;
 }
 
-static uint16_t cluster_alloc_free(fat_t *fat, int count) {
-    if (!count) {
+// find a run of free clusters starting from the hint
+// the first run long enough for "count" is taken (first fit),
+// if there is none the longest run is returned, and run_len is set to its length
+static int cluster_find_run(fat_t *fat, int count, int *run_len) {
+    int best = -1;
+    int best_len = 0;
+
+    int i = bitmap_find_bit(&fat->free_bitmap, 1, fat->next_free);
+    while (i >= 0) {
+        int end = bitmap_find_bit(&fat->free_bitmap, 0, i);
+        if (end < 0) {
+            end = fat->cluster_cnt;
+        }
+
+        int len = end - i;
+        if (len >= count) {
+            *run_len = count;
+            return i;
+        }
+        if (len > best_len) {
+            best = i;
+            best_len = len;
+        }
+
+        if (end >= fat->cluster_cnt) {
+            break;
+        }
+        i = bitmap_find_bit(&fat->free_bitmap, 1, end);
+    }
+
+    *run_len = best_len;
+    return best;
+}
+
+// allocate "count" clusters and link them into a chain
+// contiguous runs are preferred so that files are not fragmented:
+// clusters right behind "goal" (usually the last cluster of the file + 1) are tried first,
+// then the first free run which is long enough, and only when the disk is fragmented
+// the chain is built from several runs, the longest first
+static uint16_t cluster_alloc_free(fat_t *fat, int count, uint16_t goal) {
+    if (!count || count > fat->free_cnt) {
         return FAT_CLUSTER_INVALID;
     }
 
     uint16_t start = FAT_CLUSTER_INVALID;
     uint16_t pre = FAT_CLUSTER_INVALID;
-    int fat_tbl_len = fat->tbl_sectors * fat->bytes_per_sec / sizeof(uint16_t);
-    for (uint16_t i = 2; count > 0 && i < fat_tbl_len; i++) {
-        uint16_t next = cluster_get_next(fat, i);
-        if (next == FAT_CLUSTER_FREE) {
-            if (cluster_invalid(start)) {
-                start = i;
-                pre = i;
-                count--;
-                continue;
-            }
+    while (count > 0) {
+        int run_start;
+        int run_len;
+        if (!cluster_invalid(goal) && (goal < fat->cluster_cnt) && bitmap_is_set(&fat->free_bitmap, goal)) {
+            int end = bitmap_find_bit(&fat->free_bitmap, 0, goal);
+            run_start = goal;
+            run_len = ((end < 0) ? fat->cluster_cnt : end) - goal;
+        } else {
+            run_start = cluster_find_run(fat, count, &run_len);
+        }
+        if (run_start < 0) {
+            cluster_free_chain(fat, start);
+            return FAT_CLUSTER_INVALID;
+        }
+        // goal is only useful for the first run
+        goal = FAT_CLUSTER_INVALID;
 
-            int ret = cluster_set_next(fat, pre, i);
+        if (run_len > count) {
+            run_len = count;
+        }
+
+        for (int i = run_start; i < run_start + run_len; i++) {
+            // mark it as the end of chain first, so that it is taken right away
+            int ret = cluster_set_next(fat, i, FAT_CLUSTER_INVALID);
             if (ret < 0) {
                 cluster_free_chain(fat, start);
                 return FAT_CLUSTER_INVALID;
             }
+
+            if (cluster_invalid(start)) {
+                start = i;
+            } else {
+                ret = cluster_set_next(fat, pre, i);
+                if (ret < 0) {
+                    cluster_free_chain(fat, start);
+                    cluster_set_next(fat, i, FAT_CLUSTER_FREE);
+                    return FAT_CLUSTER_INVALID;
+                }
+            }
             pre = i;
-            count--;
         }
+
+        count -= run_len;
     }
 
-    if (count > 0) {
-        cluster_free_chain(fat, start);
-        return FAT_CLUSTER_INVALID;
+    // clusters before the hint are all in use, move it to the first free one
+    if ((fat->next_free < fat->cluster_cnt) && !bitmap_is_set(&fat->free_bitmap, fat->next_free)) {
+        int next = bitmap_find_bit(&fat->free_bitmap, 1, fat->next_free);
+        fat->next_free = (next < 0) ? fat->cluster_cnt : next;
     }
+    return start;
+}
 
-    int ret = cluster_set_next(fat, pre, FAT_CLUSTER_INVALID);
-    if (ret < 0) {
-        cluster_free_chain(fat, start);
-        return FAT_CLUSTER_INVALID;
+// count how many clusters starting from "cluster" are physically contiguous,
+// at most "max" clusters and no more than one disk command could transfer
+static int cluster_run_len(fat_t *fat, uint16_t cluster, int max) {
+    int limit = FAT_IO_MAX_SECTORS / fat->sec_per_cluster;
+    if (max > limit) {
+        max = limit;
     }
 
-    return start;
+    int len = 1;
+    while (len < max) {
+        uint16_t next = cluster_get_next(fat, cluster);
+        if (next != cluster + 1) {
+            break;
+        }
+        cluster = next;
+        len++;
+    }
+    return len;
 }
 
 // after this function the file size still remains the same
 // but the clusters are expanded
+// all the clusters needed are allocated at once, so a large write gets one contiguous run
 static int expand_file(file_t *file, int inc_size) {
     fat_t *fat = (fat_t*)file->fs->data;
     int cluster_offset = (file->size - 1) % fat->cluster_byte_size;
@@ -328,80 +808,178 @@ static int expand_file(file_t *file, int inc_size) {
     if (inc_size > cluster_remain) {
         int cluster_extra_need = up(inc_size - cluster_remain, fat->cluster_byte_size) / fat->cluster_byte_size;
 
-        uint16_t start = cluster_alloc_free(fat, cluster_extra_need);
+        if (cluster_invalid(file->sblk)) {
+            uint16_t start = cluster_alloc_free(fat, cluster_extra_need, FAT_CLUSTER_INVALID);
+            if (cluster_invalid(start)) {
+                return -1;
+            }
+            file->sblk = file->cblk = start;
+            return fat_table_flush(fat);
+        }
+
+        // cblk is not necessarily the last cluster (e.g. after seeking back),
+        // and it is invalid when the position is right at the end of the chain
+        uint16_t last = cluster_invalid(file->cblk) ? file->sblk : file->cblk;
+        uint16_t next;
+        while (!cluster_invalid(next = cluster_get_next(fat, last))) {
+            last = next;
+        }
+
+        uint16_t start = cluster_alloc_free(fat, cluster_extra_need, last + 1);
         if (cluster_invalid(start)) {
             return -1;
         }
-        if (cluster_invalid(file->sblk)) {
-            file->sblk = file->cblk = start;
-            return 0;
-        } 
-        int ret = cluster_set_next(fat, file->cblk, start);
+        int ret = cluster_set_next(fat, last, start);
         if (ret < 0) {
+            cluster_free_chain(fat, start);
             return -1;
         }
-        return 0;
+        if (cluster_invalid(file->cblk)) {
+            file->cblk = start;
+        }
+        return fat_table_flush(fat);
     }
 
     return 0;
 }
 
+// find a free entry in the directory for a new file
+// a full subdirectory is grown by one zeroed cluster
+static int dir_alloc_entry(fat_t *fat, uint16_t dir) {
+    if (dir == FAT_ROOT_DIR) {
+        return root_index_alloc(fat);
+    }
+
+    diritem_t item;
+    int i = 0;
+    uint16_t last = dir;
+    for (; read_dir_entry(fat, dir, i, &item) == 0; i++) {
+        if (item.DIR_Name[0] == DIRITEM_NAME_END || item.DIR_Name[0] == DIRITEM_NAME_FREE) {
+            return i;
+        }
+    }
+
+    uint16_t next;
+    while (!cluster_invalid(next = cluster_get_next(fat, last))) {
+        last = next;
+    }
+    uint16_t cluster = cluster_alloc_free(fat, 1, last + 1);
+    if (cluster_invalid(cluster)) {
+        return -1;
+    }
+
+    // the new cluster is all end marks
+    int sector_idx = fat->data_start + fat->sec_per_cluster * (cluster - 2);
+    kernel_memset(fat->fat_buffer, 0, fat->cluster_byte_size);
+    int ret = dev_write(fat->fs->dev_id, sector_idx, fat->fat_buffer, fat->sec_per_cluster);
+    fat->sector_idx = (ret == fat->sec_per_cluster) ? sector_idx : -1;
+    if (ret != fat->sec_per_cluster || cluster_set_next(fat, last, cluster) < 0) {
+        cluster_free_chain(fat, cluster);
+        fat_table_flush(fat);
+        return -1;
+    }
+
+    fat_table_flush(fat);
+    return i;
+}
+
+// open an existing entry, O_TRUNC is done afterwards by fatfs_truncate
+static int fatfs_open_item(fs_t *fs, diritem_t *item, file_t *file, uint16_t dir, int index) {
+    fat_t *fat = (fat_t*)fs->data;
+    // a directory must not be truncated or written as a file
+    if ((item->DIR_Attr & DIRITEM_ATTR_DIRECTORY) && (file->mode & (O_WRONLY | O_RDWR | O_TRUNC))) {
+        return -1;
+    }
+    read_item_to_file(fat, item, file, dir, index);
+    return 0;
+}
+
+// called with the file lock and fat->mutex held, so no read or write of the file is in the middle
+// of its chain. the entry is read again since it could be unlinked after open released the lock,
+// or another open of the file may have given it its first cluster since
+int fatfs_truncate(file_t *file) {
+    fat_t *fat = (fat_t*)file->fs->data;
+    diritem_t item;
+    if (read_dir_entry(fat, file->ino >> 16, file->ino & 0xFFFF, &item) < 0) {
+        return -1;
+    }
+    if (item.DIR_Name[0] == DIRITEM_NAME_END || item.DIR_Name[0] == DIRITEM_NAME_FREE) {
+        return -1;
+    }
+
+    file->sblk = (item.DIR_FstClusHI << 16) | item.DIR_FstClusL0;
+    cluster_free_chain(fat, file->sblk);
+    fat_table_flush(fat);
+    pcache_invalidate(file->fs, file->ino);
+    file->sblk = file->cblk = FAT_CLUSTER_INVALID;
+    file->size = 0;
+    file->pos = 0;
+    return 0;
+}
+
 // fill in the necessary
 int fatfs_open(struct _fs_t *fs, const char *path, file_t *file) {
     fat_t *fat = (fat_t*)fs->data;
     diritem_t *item = (diritem_t*)0;
     diritem_t p_item;
-    int found_index = -1;
-    int free_index = -1;
-    for (int i = 0; i < fat->root_ent_cnt; i++) {
-        int ret = read_dir_entry(fat, i, &p_item);
+
+    // each component is formatted once and looked up in the root index
+    // or the subdirectory cache, only the matching entry is read from disk
+    uint8_t format_name[FORMAT_NAME_LEN];
+    uint16_t p_dir;
+    int found_index;
+    if (fat_lookup(fat, path, &p_dir, &found_index, format_name) < 0) {
+        return -1;
+    }
+    if (found_index >= 0) {
+        int ret = read_dir_entry(fat, p_dir, found_index, &p_item);
         if (ret < 0) {
             return -1;
         }
-        if (p_item.DIR_Name[0] == DIRITEM_NAME_END) {
-            if (free_index == -1) {
-                free_index = i;
-            }
-            break;
-        }
-        if (p_item.DIR_Name[0] == DIRITEM_NAME_FREE) {
-            free_index = i;
-            continue;
-        }
-        if(diritem_name_match(path, &p_item)) {
-            found_index = i;
-            item = &p_item;
-            break;
-        }
+        item = &p_item;
     }
 
     if (item) {
-        read_item_to_file(fat, item, file, found_index);
-        if (file->mode & O_TRUNC) {
-            cluster_free_chain(fat, file->sblk);
-            file->sblk = file->cblk = FAT_CLUSTER_INVALID;
-            file->size = 0;
-            file->pos = 0;
-        }
-        return 0;
+        return fatfs_open_item(fs, item, file, p_dir, found_index);
     }
     
-    if (file->mode & O_CREAT && free_index != -1) {
+    if (!(file->mode & O_CREAT)) {
+        return -1;
+    }
+
+    int free_index = dir_alloc_entry(fat, p_dir);
+    if (free_index != -1) {
         diritem_t new_item;
-        diritem_init(&new_item, 0, path);
+        diritem_init(&new_item, 0, format_name);
         // write new_item (in memory) into the item table (disk)
-        int ret = write_dir_entry(fat, &new_item, free_index);
+        int ret = write_dir_entry(fat, &new_item, p_dir, free_index);
         if (ret < 0) {
             log_printf("create new file failed");
             return ret;
         }
-        read_item_to_file(fat, &new_item, file, free_index);
+        read_item_to_file(fat, &new_item, file, p_dir, free_index);
         return 0;
     }
     
     return -1;
 }
 
+// open the entry found by an earlier open (see path cache), no path is parsed
+int fatfs_open_ino(struct _fs_t *fs, uint32_t ino, file_t *file) {
+    fat_t *fat = (fat_t*)fs->data;
+    uint16_t dir = ino >> 16;
+    int index = ino & 0xFFFF;
+
+    diritem_t item;
+    if (read_dir_entry(fat, dir, index, &item) < 0) {
+        return -1;
+    }
+    if (item.DIR_Name[0] == DIRITEM_NAME_END || item.DIR_Name[0] == DIRITEM_NAME_FREE) {
+        return -1;
+    }
+    return fatfs_open_item(fs, &item, file, dir, index);
+}
+
 // since file pos is the position where the next byte is going to write at,
 // it is possible that after expanding file in fatfs_write, the eventual file pos 
 // still needs an extra cluster
@@ -410,11 +988,13 @@ static int move_file_pos(file_t *file , int move_bytes, fat_t *fat, int expand)
     if (offset + move_bytes >= fat->cluster_byte_size) {
         uint16_t next = cluster_get_next(fat, file->cblk);
         if ((next == FAT_CLUSTER_INVALID) && expand) {
+            mutex_lock(&fat->mutex);
             int ret = expand_file(file, fat->cluster_byte_size);
+            mutex_unlock(&fat->mutex);
             if (ret < 0) {
                 return ret;
             }
-            next = cluster_get_next(fat, file->cblk);;
+            next = cluster_get_next(fat, file->cblk);
         }
         file->cblk = next;
     }
@@ -427,6 +1007,11 @@ static int move_file_pos(file_t *file , int move_bytes, fat_t *fat, int expand)
 // after completing this function i found that in fatfs_read and write the unit is cluster
 // however when reading and writing fat table and directory items we use sector as unit
 // why fatfs_read/write use cluster as unit? => since the fat table is designed for cluster number
+// read and write are called with the lock of the file held instead of fat->mutex,
+// fat->mutex is only taken around the fat table and fat_buffer, so whole cluster
+// transfers of different files don't wait for each other
+// (walking the chain of the file is safe: it is only changed by writers of the file,
+// truncate and unlink, and all of them hold the file lock)
 int fatfs_read(char *buf, int size, file_t *file) {
     fat_t *fat = (fat_t*)file->fs->data;
 
@@ -443,32 +1028,41 @@ int fatfs_read(char *buf, int size, file_t *file) {
         // it is the sector where the "file position" locates at
         int start_sector = fat->data_start + fat->sec_per_cluster * (file->cblk - 2);
         if (cluster_offset == 0 && nbytes >= fat->cluster_byte_size) {
-            int ret = dev_read(fat->fs->dev_id, start_sector, buf, fat->sec_per_cluster);
+            // physically contiguous clusters are read with a single disk command
+            int run = cluster_run_len(fat, file->cblk, nbytes / fat->cluster_byte_size);
+            int run_bytes = run * fat->cluster_byte_size;
+            int ret = dev_read(fat->fs->dev_id, start_sector, buf, run * fat->sec_per_cluster);
             if (ret < 0) {
                 log_printf("read error in fatfs read");
                 return total;
             }
-            nbytes -= fat->cluster_byte_size;
-            buf += fat->cluster_byte_size;
-            total += fat->cluster_byte_size;
-            ret = move_file_pos(file, fat->cluster_byte_size, fat, 0);
-            if (ret < 0) {
-                log_printf("move file position failed");
-                return total;
+            nbytes -= run_bytes;
+            buf += run_bytes;
+            total += run_bytes;
+            for (int i = 0; i < run; i++) {
+                ret = move_file_pos(file, fat->cluster_byte_size, fat, 0);
+                if (ret < 0) {
+                    log_printf("move file position failed");
+                    return total;
+                }
             }
             continue;
         }
 
         int cluster_remain = fat->cluster_byte_size - cluster_offset;
         int read_bytes = (nbytes > cluster_remain) ? cluster_remain : nbytes;
+        mutex_lock(&fat->mutex);
         fat->sector_idx = start_sector;
         int ret = dev_read(fat->fs->dev_id, start_sector, fat->fat_buffer, fat->sec_per_cluster);
         if (ret < 0) {
+            fat->sector_idx = -1;
+            mutex_unlock(&fat->mutex);
             log_printf("read error in fatfs read");
             return total;
         }
 
         kernel_memcpy(buf, fat->fat_buffer + cluster_offset, read_bytes);
+        mutex_unlock(&fat->mutex);
 
         buf += read_bytes;
         total += read_bytes;
@@ -492,7 +1086,9 @@ int fatfs_write(char *buf, int size, file_t *file) {
 
     if (file->pos + size > file->size) { // pos <= size - 1
         int inc_size = file->pos + size - file->size;
+        mutex_lock(&fat->mutex);
         int ret = expand_file(file, inc_size);
+        mutex_unlock(&fat->mutex);
         if (ret < 0) {
             return 0; // this function returns how many bytes written
         }
@@ -504,31 +1100,44 @@ int fatfs_write(char *buf, int size, file_t *file) {
         int cluster_offset = file->pos % fat->cluster_byte_size;
         int start_sector = fat->data_start + fat->sec_per_cluster * (file->cblk - 2);
         if (cluster_offset == 0 && nbytes >= fat->cluster_byte_size) {
-            if (fat->sector_idx == start_sector) {
-                kernel_memcpy(fat->fat_buffer, buf, fat->cluster_byte_size);
+            // physically contiguous clusters are written with a single disk command
+            int run = cluster_run_len(fat, file->cblk, nbytes / fat->cluster_byte_size);
+            int run_bytes = run * fat->cluster_byte_size;
+            int run_sectors = run * fat->sec_per_cluster;
+            mutex_lock(&fat->mutex);
+            if (fat->sector_idx >= start_sector && fat->sector_idx < start_sector + run_sectors) {
+                // the buffered cluster is overwritten, drop it
+                fat->sector_idx = -1;
             }
-            int ret = dev_write(fat->fs->dev_id, start_sector, buf, fat->sec_per_cluster);
+            mutex_unlock(&fat->mutex);
+            int ret = dev_write(fat->fs->dev_id, start_sector, buf, run_sectors);
             if (ret < 0) {
                 log_printf("dev write failed during fatfs write");
                 return total_write;
             }
 
-            total_write += fat->cluster_byte_size;
-            nbytes -= fat->cluster_byte_size;
-            ret = move_file_pos(file, fat->cluster_byte_size, fat, 1);
-            if (ret < 0) {
-                log_printf("dev write failed during fatfs write");
-                return total_write;
+            buf += run_bytes;
+            total_write += run_bytes;
+            nbytes -= run_bytes;
+            for (int i = 0; i < run; i++) {
+                ret = move_file_pos(file, fat->cluster_byte_size, fat, 1);
+                if (ret < 0) {
+                    log_printf("dev write failed during fatfs write");
+                    return total_write;
+                }
             }
             continue;
         }
 
         int cluster_remain = fat->cluster_byte_size - cluster_offset;
         int write_bytes = (nbytes > cluster_remain) ? cluster_remain : nbytes;
+        mutex_lock(&fat->mutex);
         if (fat->sector_idx != start_sector) {
             fat->sector_idx = start_sector;
             int err = dev_read(fat->fs->dev_id, start_sector, fat->fat_buffer, fat->sec_per_cluster);
             if (err < 0) {
+                fat->sector_idx = -1;
+                mutex_unlock(&fat->mutex);
                 return total_write;
             }
         }
@@ -536,11 +1145,13 @@ int fatfs_write(char *buf, int size, file_t *file) {
         kernel_memcpy(fat->fat_buffer + cluster_offset, buf, write_bytes);
             
         int ret = dev_write(fat->fs->dev_id, start_sector, fat->fat_buffer, fat->sec_per_cluster);
+        mutex_unlock(&fat->mutex);
         if (ret < 0) {
             log_printf("dev write failed during fatfs write");
             return total_write;
         }
 
+        buf += write_bytes;
         total_write += write_bytes;
         nbytes -= write_bytes;
         ret = move_file_pos(file, write_bytes, fat, 1);
@@ -554,8 +1165,32 @@ int fatfs_write(char *buf, int size, file_t *file) {
     return total_write;
 }
 
+// name is a path from root directory, "" or "/" is the root directory itself
 int fatfs_opendir(struct _fs_t *fs, const char *name, DIR *dir) {
+    fat_t *fat = (fat_t*)fs->data;
     dir->index = 0;
+    dir->cluster = FAT_ROOT_DIR;
+
+    const char *p = name;
+    while (*p == '/') {
+        p++;
+    }
+    if (!*p) {
+        return 0;
+    }
+
+    uint8_t format_name[FORMAT_NAME_LEN];
+    uint16_t p_dir;
+    int index;
+    if (fat_lookup(fat, name, &p_dir, &index, format_name) < 0 || index < 0) {
+        return -1;
+    }
+
+    diritem_t item;
+    if (read_dir_entry(fat, p_dir, index, &item) < 0 || diritem_get_type(&item) != FILE_DIR) {
+        return -1;
+    }
+    dir->cluster = item.DIR_FstClusL0;
     return 0;
 }
 
@@ -593,11 +1228,11 @@ static void diritem_get_name(char *dirent_name, diritem_t *item) {
 
 int fatfs_readdir(struct _fs_t *fs, DIR *dir) {
     fat_t *fat = (fat_t*)fs->data;
-    while (dir->index < fat->root_ent_cnt) {
+    while (dir->cluster != FAT_ROOT_DIR || dir->index < fat->root_ent_cnt) {
         diritem_t item;
-        int ret = read_dir_entry(fat, dir->index, &item);
+        int ret = read_dir_entry(fat, dir->cluster, dir->index, &item);
         if (ret < 0) {
-            log_printf("read dir entry failed");
+            // the end of a subdirectory chain
             return -1;
         }
         
@@ -605,7 +1240,8 @@ int fatfs_readdir(struct _fs_t *fs, DIR *dir) {
             break;
         }
 
-        if (item.DIR_Name[0] == DIRITEM_NAME_FREE) {
+        // "." and ".." are skipped as well
+        if (item.DIR_Name[0] == DIRITEM_NAME_FREE || item.DIR_Name[0] == '.') {
             dir->index++;
             continue;
         }
@@ -632,90 +1268,157 @@ int fatfs_closedir(struct _fs_t *fs, DIR *dir) {
 
 // write the info in file structure to disk (diritem)
 void fatfs_close(file_t *file) {
+    if (file->cmap) {
+        mem_free_page((uint32_t)file->cmap, 1);
+        file->cmap = (uint16_t*)0;
+        file->cmap_cnt = 0;
+    }
+
     if (file->mode == O_RDONLY) {
         return;
     }
 
     fat_t *fat = (fat_t*)file->fs->data;
     diritem_t item;
-    read_dir_entry(fat, file->p_index, &item);
+    read_dir_entry(fat, file->p_dir, file->p_index, &item);
     
     item.DIR_FileSize = file->size;
     // this is needed since it is possible that sblk is invalid at first
     item.DIR_FstClusHI = file->sblk >> 16;
     item.DIR_FstClusL0 = file->sblk;
-    write_dir_entry(fat, &item, file->p_index);
+    write_dir_entry(fat, &item, file->p_dir, file->p_index);
+}
+
+// find the "idx"-th cluster of the file
+// the cached part of the chain is a single lookup, only the rest is walked
+// and the clusters walked through are appended to the map
+static uint16_t file_cluster_at(fat_t *fat, file_t *file, int idx) {
+    if (!file->cmap) {
+        // if there is no page for the map, seek still works by walking the chain
+        file->cmap = (uint16_t*)mem_alloc_page(1);
+        file->cmap_cnt = 0;
+    }
+
+    uint16_t curr = file->sblk;
+    int curr_idx = 0;
+    if (file->cmap) {
+        if (file->cmap_cnt == 0 && !cluster_invalid(file->sblk)) {
+            file->cmap[file->cmap_cnt++] = file->sblk;
+        }
+        if (idx < file->cmap_cnt) {
+            return file->cmap[idx];
+        }
+        if (file->cmap_cnt > 0) {
+            curr_idx = file->cmap_cnt - 1;
+            curr = file->cmap[curr_idx];
+        }
+    }
+
+    while (curr_idx < idx && !cluster_invalid(curr)) {
+        curr = cluster_get_next(fat, curr);
+        curr_idx++;
+        // the chain only grows at the end while the file is open, so the map never gets stale
+        if (file->cmap && curr_idx == file->cmap_cnt 
+                && file->cmap_cnt < FAT_CMAP_SIZE && !cluster_invalid(curr)) {
+            file->cmap[file->cmap_cnt++] = curr;
+        }
+    }
+
+    return curr;
 }
 
-int fatfs_seek(file_t *file, uint32_t offset, int dir) {
-    // file->pos <= offset, set file pos as offset
-    if (dir != 0) {
+// returns the new position
+int fatfs_seek(file_t *file, int offset, int dir) {
+    int pos;
+    switch (dir) {
+    case SEEK_SET:
+        pos = offset;
+        break;
+    case SEEK_CUR:
+        pos = file->pos + offset;
+        break;
+    case SEEK_END:
+        pos = file->size + offset;
+        break;
+    default:
+        return -1;
+    }
+
+    // there are no holes in fat files, so seeking beyond the end is not allowed
+    if (pos < 0 || pos > file->size) {
         return -1;
     }
 
-    // starts from the starting cluster 
     fat_t *fat = (fat_t*)file->fs->data;
-    uint16_t curr_blk = file->sblk;
-    int curr_pos = 0;
-    int remain = offset;
-
-    while (remain) {
-        if (remain >= fat->cluster_byte_size) {
-            remain -= fat->cluster_byte_size;
-            curr_pos += fat->cluster_byte_size;
-            curr_blk = cluster_get_next(fat, curr_blk);
-            if (cluster_invalid(curr_blk)) {
-                return -1;
-            }
-            continue;
-        }
-        curr_pos += remain;
-        remain -= remain;
+    uint16_t cblk = file_cluster_at(fat, file, pos / fat->cluster_byte_size);
+    // when pos is at the end and at a cluster boundary, cblk could be invalid
+    // which is the same as what move_file_pos does
+    if (cluster_invalid(cblk) && pos < file->size) {
+        return -1;
     }
 
-    file->pos = curr_pos;
-    file->cblk = curr_blk;
-    return 0;
+    file->pos = pos;
+    file->cblk = cblk;
+    return pos;
 }
 
 int fatfs_stat(file_t *file, struct stat *st) {
     return -1;
 }
 
-int fatfs_unlink(fs_t *fs, const char *file_name) {
+int fatfs_lookup(fs_t *fs, const char *file_name, uint32_t *ino) {
     fat_t *fat = (fat_t*)fs->data;
-    for (int i = 0; i < fat->root_ent_cnt; i++) {
-        diritem_t p_item;
-        int ret = read_dir_entry(fat, i, &p_item);
-        if (ret < 0) {
-            break;
-        }
-        if (p_item.DIR_Name[0] == DIRITEM_NAME_END) {
-            break;
-        }
-        if (p_item.DIR_Name[0] == DIRITEM_NAME_FREE) {
-            continue;
-        }
-        if(diritem_name_match(file_name, &p_item)) {
-            int ret = cluster_free_chain(fat, p_item.DIR_FstClusL0);
-            if (ret < 0) {
-                return ret;
-            }
-            diritem_t item;
-            kernel_memset(&item, 0, sizeof(diritem_t));
-            item.DIR_Name[0] = DIRITEM_NAME_FREE;
-            write_dir_entry(fat, &item, i);
-            return 0;
-        }
+    uint8_t format_name[FORMAT_NAME_LEN];
+    uint16_t p_dir;
+    int index;
+    if (fat_lookup(fat, file_name, &p_dir, &index, format_name) < 0 || index < 0) {
+        return -1;
     }
-    
-    return -1;    
+    *ino = FAT_INO(p_dir, index);
+    return 0;
+}
+
+// the caller holds the file lock of ino, so the clusters are not in use by read or write
+int fatfs_unlink(fs_t *fs, const char *file_name, uint32_t ino) {
+    fat_t *fat = (fat_t*)fs->data;
+    uint8_t format_name[FORMAT_NAME_LEN];
+    uint16_t p_dir;
+    int index;
+    if (fat_lookup(fat, file_name, &p_dir, &index, format_name) < 0 || index < 0) {
+        return -1;
+    }
+    if (FAT_INO(p_dir, index) != ino) {
+        return FS_ERR_RETRY;
+    }
+
+    diritem_t item;
+    int ret = read_dir_entry(fat, p_dir, index, &item);
+    if (ret < 0) {
+        return ret;
+    }
+    // directories are not removed, their clusters may still be cached
+    if (item.DIR_Attr & DIRITEM_ATTR_DIRECTORY) {
+        return -1;
+    }
+
+    ret = cluster_free_chain(fat, item.DIR_FstClusL0);
+    if (ret < 0) {
+        return ret;
+    }
+    fat_table_flush(fat);
+    pcache_invalidate(fs, FAT_INO(p_dir, index));
+    path_cache_remove(fs, FAT_INO(p_dir, index));
+
+    kernel_memset(&item, 0, sizeof(diritem_t));
+    item.DIR_Name[0] = DIRITEM_NAME_FREE;
+    return write_dir_entry(fat, &item, p_dir, index);
 }
 
 fs_op_t fatfs_op = {
     .mount = fatfs_mount,
     .unmount = fatfs_unmount,
     .open = fatfs_open,
+    .open_ino = fatfs_open_ino,
     .close = fatfs_close,
     .read = fatfs_read,
     .write = fatfs_write,
@@ -724,5 +1427,7 @@ fs_op_t fatfs_op = {
     .opendir = fatfs_opendir,
     .readdir = fatfs_readdir,
     .closedir = fatfs_closedir,
+    .lookup = fatfs_lookup,
     .unlink = fatfs_unlink,
+    .truncate = fatfs_truncate,
 };
\ No newline at end of file
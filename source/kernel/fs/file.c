@@ -6,37 +6,43 @@
 // bss has been zeroed (initial values are zeroes)
 static file_t file_table[FILE_TABLE_SIZE];
 
+// indexes of unused entries, used as a stack so that alloc and free are O(1)
+static uint16_t file_free_list[FILE_TABLE_SIZE];
+static int file_free_count;
+
 static mutex_t file_table_mutex;
 
 void file_table_init(void) {
     mutex_init(&file_table_mutex);
     kernel_memset(file_table, 0, sizeof(file_table));
+
+    // entry 0 is on the top
+    for (int i = 0; i < FILE_TABLE_SIZE; i++) {
+        file_free_list[i] = FILE_TABLE_SIZE - 1 - i;
+    }
+    file_free_count = FILE_TABLE_SIZE;
 }
 
-// free the occupied space
+// drop a reference, the entry is reused after the last one is dropped
 void file_free(file_t *file) {
     mutex_lock(&file_table_mutex);
 
-    if (file->ref) {
-        file->ref--;
+    if (file->ref && --file->ref == 0) {
+        file_free_list[file_free_count++] = file - file_table;
     }
 
     mutex_unlock(&file_table_mutex);
 }
 
-// find an empty space in file_table
-// using ref
+// take an unused entry from the free list
 file_t *file_alloc(void) {
     file_t *p = (file_t*)0;
     mutex_lock(&file_table_mutex);
 
-    for (int i = 0; i < FILE_TABLE_SIZE; i++) {
-        p = file_table + i;
-        if (p->ref == 0) {
-            kernel_memset(p, 0, sizeof(file_t));
-            p->ref = 1;
-            break;
-        }
+    if (file_free_count > 0) {
+        p = file_table + file_free_list[--file_free_count];
+        kernel_memset(p, 0, sizeof(file_t));
+        p->ref = 1;
     }
 
     mutex_unlock(&file_table_mutex);
@@ -11,6 +11,11 @@
 #include <sys/file.h>
 #include "dev/disk.h"
 #include "applib/lib_syscall.h"
+#include "fs/pcache.h"
+#include "core/vma.h"
+#include "fs/pathcache.h"
+#include "fs/pipe.h"
+#include "core/memory.h"
 
 // shell is stored in the 5000th sector
 // these functions are specifically for shell and are temparily simplified
@@ -18,15 +23,18 @@
 #define FS_TABLE_SIZE 10
 static fs_t fs_table[FS_TABLE_SIZE];
 
-static uint8_t TEMP_ADDR[100*1024];
-static uint8_t *temp_pos; // current position in file
-#define TEMP_FILE_ID 100
-
 extern fs_op_t devfs_op;
 extern fs_op_t fatfs_op;
 
 static fs_t *root_fs;
 
+// data i/o of regular files is serialized per file instead of per filesystem,
+// so a task waiting on the disk for one file doesn't block the others
+// a mutex for every file entry would be too large, files are hashed into a few locks
+// (the filesystem mutex stays as the lock of the metadata, e.g. fat table and directories)
+#define FILE_LOCK_NUM 32
+static mutex_t file_locks[FILE_LOCK_NUM];
+
 static void read_disk(uint32_t sector, uint32_t sector_count, uint8_t *buf) {
     outb(0x1F6, 0xE0); // fifth and seventh bit should be set to 1 (fixed usage), sixth bit is set to 1 to choose LBA mode
     outb(0x1F2, (uint8_t)(sector_count >> 8)); // first byte (from right)
@@ -64,6 +72,24 @@ static const char *next_path(const char *path) {
     return p;
 }
 
+// find the fs mounted at the start of name, *path is set to the rest of name
+// names without a known mount point go to root_fs as they are
+// *path is null when name is the mount point itself (e.g. "/home")
+static fs_t *mount_lookup(const char *name, const char **path) {
+    for (int i = 0; i < FS_TABLE_SIZE; i++) {
+        fs_t *p = fs_table + i;
+        if (kernel_strlen(p->mount_point) == 0 || kernel_strncmp(p->mount_point, name, kernel_strlen(p->mount_point)) != 0) {
+            continue;
+        }
+        *path = next_path(name);
+        return p;
+    }
+
+    // didn't find the mounted fs
+    *path = name;
+    return root_fs;
+}
+
 static void fs_protect(fs_t *fs) {
     if (fs->mutex) {
         mutex_lock(fs->mutex);
@@ -76,6 +102,68 @@ static void fs_unprotect(fs_t *fs) {
     }
 }
 
+// all opens of the same file share a lock since they read and write the same clusters
+// it is taken before the fs lock, never the other way round
+static mutex_t *file_lock_of_ino(fs_t *fs, uint32_t ino) {
+    uint32_t hash = ((uint32_t)fs >> 4) ^ ino ^ (ino >> 16);
+    return &file_locks[hash % FILE_LOCK_NUM];
+}
+
+static mutex_t *file_lock_of(file_t *file) {
+    return file_lock_of_ino(file->fs, file->ino);
+}
+
+// devices keep the lock of their filesystem
+static void file_protect(file_t *file) {
+    if (file->type == FILE_NORMAL) {
+        mutex_lock(file_lock_of(file));
+    } else {
+        fs_protect(file->fs);
+    }
+}
+
+static void file_unprotect(file_t *file) {
+    if (file->type == FILE_NORMAL) {
+        mutex_unlock(file_lock_of(file));
+    } else {
+        fs_unprotect(file->fs);
+    }
+}
+
+// bytes moved by the current task, shown by ps
+static void file_account(int read, int bytes) {
+    task_t *curr = task_current();
+    if (!curr || bytes <= 0) {
+        return;
+    }
+    if (read) {
+        curr->stat.read_bytes += bytes;
+    } else {
+        curr->stat.write_bytes += bytes;
+    }
+}
+
+// read or write at the file position, buf is already accessible without page faults
+static int file_read(file_t *file, char *buf, int len) {
+    file_protect(file);
+    int ret = file->fs->op->read(buf, len, file);
+    file_unprotect(file);
+    file_account(1, ret);
+    return ret;
+}
+
+static int file_write(file_t *file, char *buf, int len) {
+    file_protect(file);
+    int ret = file->fs->op->write(buf, len, file);
+    if (ret > 0 && file->type == FILE_NORMAL) {
+        // mapped pages of the file see the new data
+        pcache_write(file, file->pos - ret, buf, ret);
+    }
+    file_unprotect(file);
+    file_account(0, ret);
+    return ret;
+}
+
 static int is_invalid_fd(int fd) {
     if (fd < 0 && fd >= OPEN_FILE_NUM) {
         return -1;
@@ -98,6 +186,7 @@ int sys_open(const char *name, int flags, ...) {
     //     return TEMP_FILE_ID;
     // }
 
+    vma_prefault_str(name);
     file_t *file = file_alloc();
     if (!file) {
         goto sys_open_failed;
@@ -109,40 +198,78 @@ int sys_open(const char *name, int flags, ...) {
         goto sys_open_failed;
     }
 
+    // repeated opens of the same path skip the mount table and the directory lookup
     fs_t *fs = (fs_t*)0;
-    for (int i = 0; i < FS_TABLE_SIZE; i++) {
-        fs_t *p = fs_table + i;
-        if (kernel_strlen(p->mount_point) == 0 || kernel_strncmp(p->mount_point, name, kernel_strlen(p->mount_point)) != 0) {
-            continue;
-        }
-        fs = p;
-        break;
+    uint32_t ino = 0;
+    int cached = path_cache_lookup(name, &fs, &ino);
+    if (cached < 0 && !(flags & O_CREAT)) {
+        goto sys_open_failed;
     }
 
-    if (!fs) {
-        // didn't find the mounted fs
-        fs = root_fs;
-    } else {
-        name = next_path(name);
-        if (!name) {
+    const char *path = name;
+    if (cached <= 0) {
+        fs = mount_lookup(name, &path);
+        if (!path) {
             goto sys_open_failed;
         }
     }
 
+    fs_protect(fs);
+    if (cached > 0) {
+        // the entry was read without the fs lock, an unlink (and a create reusing
+        // the directory slot) may have come in between. unlink drops the entry
+        // under the fs lock, so an entry that is still the same now is still right
+        fs_t *cached_fs;
+        uint32_t cached_ino;
+        if (path_cache_lookup(name, &cached_fs, &cached_ino) <= 0 ||
+            cached_fs != fs || cached_ino != ino) {
+            cached = 0;
+            mount_lookup(name, &path); // the same fs, only the path inside it is needed
+        }
+    }
+
     // file->dev_id = -1; no need to set?
     file->mode = flags;
     file->fs = fs;
     // file->pos = 0; // tty does not use this, it uses cursor // already zero
-    kernel_strncpy(file->file_name, name, FILE_NAME_SIZE);
+    kernel_strncpy(file->file_name, path, FILE_NAME_SIZE);
 
-    fs_protect(fs);
-    int ret = fs->op->open(fs, name, file);
-    if (ret < 0) {
+    int ret;
+    if (cached > 0) {
+        ret = fs->op->open_ino(fs, ino, file);
+    } else {
+        ret = fs->op->open(fs, path, file);
+    }
+
+    // still under the fs lock, so no unlink or create can come between
+    // the lookup and the cache entry describing it
+    if (fs->op->open_ino && cached <= 0) {
+        if (ret >= 0) {
+            if (flags & O_CREAT) {
+                path_cache_remove_negative(fs); // the file may be created just now
+            }
+            path_cache_add(name, fs, file->ino, 0);
+        } else if (!(flags & (O_CREAT | O_WRONLY | O_RDWR | O_TRUNC))) {
+            // a plain open only fails when the path doesn't exist
+            path_cache_add(name, fs, 0, 1);
+        }
+    }
+    fs_unprotect(fs);
+
+    // reads and writes of the file only hold its file lock, so its clusters
+    // must not be freed under the fs lock alone
+    if (ret >= 0 && (flags & O_TRUNC) && fs->op->truncate) {
+        file_protect(file);
+        fs_protect(fs);
+        ret = fs->op->truncate(file);
         fs_unprotect(fs);
+        file_unprotect(file);
+    }
+
+    if (ret < 0) {
         goto sys_open_failed;
     }
 
-    fs_unprotect(fs);
     return fd;
 
 sys_open_failed:
@@ -188,10 +315,8 @@ int sys_read(int file, char *ptr, int len) {
     }
 
     // return dev_read(fp->dev_id, 0, ptr, len);
-    fs_protect(fp->fs);
-    int ret = fp->fs->op->read(ptr, len, fp);
-    fs_unprotect(fp->fs);
-    return ret;
+    vma_prefault((uint32_t)ptr, len, 1);
+    return file_read(fp, ptr, len);
 }
 
 // structure => printf, print_msg -> sys_write -> console_write
@@ -223,9 +348,33 @@ int sys_write(int file, char *ptr, int len) {
     }
 
     // return dev_read(fp->dev_id, 0, ptr, len);
-    fs_protect(fp->fs);
-    int ret = fp->fs->op->write(ptr, len, fp);
-    fs_unprotect(fp->fs);
+    vma_prefault((uint32_t)ptr, len, 0);
+    return file_write(fp, ptr, len);
+}
+
+// read or write at the offset, the file position is left unchanged
+// used by page cache and mapped pages which don't go through a fd
+int fs_read_at(file_t *file, char *buf, int size, uint32_t offset) {
+    file_protect(file);
+    int pos = file->pos;
+    int ret = file->fs->op->seek(file, offset, SEEK_SET);
+    if (ret >= 0) {
+        ret = file->fs->op->read(buf, size, file);
+    }
+    file->fs->op->seek(file, pos, SEEK_SET);
+    file_unprotect(file);
+    return ret;
+}
+
+int fs_write_at(file_t *file, char *buf, int size, uint32_t offset) {
+    file_protect(file);
+    int pos = file->pos;
+    int ret = file->fs->op->seek(file, offset, SEEK_SET);
+    if (ret >= 0) {
+        ret = file->fs->op->write(buf, size, file);
+    }
+    file->fs->op->seek(file, pos, SEEK_SET);
+    file_unprotect(file);
     return ret;
 }
 
@@ -248,12 +397,125 @@ int sys_lseek(int file, int ptr, int dir) {
     }
 
     // return dev_read(fp->dev_id, 0, ptr, len);
-    fs_protect(fp->fs);
+    file_protect(fp);
     int ret = fp->fs->op->seek(fp, ptr, dir);
-    fs_unprotect(fp->fs);
+    file_unprotect(fp);
     return ret;
 }
 
+// the data of regular files is taken from the page cache and written from there,
+// so it is never copied to a buffer in between, and a file read recently is not read again
+static int sendfile_cached(file_t *out, file_t *in, uint32_t pos, int count) {
+    int total = 0;
+    while (total < count && pos < in->size) {
+        uint32_t page_offset = pos % MEM_PAGE_SIZE;
+        int size = MEM_PAGE_SIZE - page_offset;
+        if (size > count - total) {
+            size = count - total;
+        }
+        if (size > in->size - pos) {
+            size = in->size - pos;
+        }
+
+        uint32_t paddr = pcache_get(in, pos / MEM_PAGE_SIZE);
+        if (!paddr) {
+            break;
+        }
+        int ret = file_write(out, (char*)paddr + page_offset, size);
+        mem_free_page(paddr, 1);
+        if (ret <= 0) {
+            break;
+        }
+
+        total += ret;
+        pos += ret;
+        if (ret < size) {
+            break;
+        }
+    }
+
+    file_account(1, total); // read from the cache, not through file_read
+    return total;
+}
+
+// pipes and devices have no page in the cache, a kernel page is used as the buffer
+static int sendfile_buffered(file_t *out, file_t *in, int count) {
+    char *buf = (char*)mem_alloc_page(1);
+    if (!buf) {
+        return -1;
+    }
+
+    int total = 0;
+    while (total < count) {
+        int size = count - total;
+        if (size > MEM_PAGE_SIZE) {
+            size = MEM_PAGE_SIZE;
+        }
+
+        int ret = file_read(in, buf, size);
+        if (ret <= 0) {
+            break;
+        }
+        int written = file_write(out, buf, ret);
+        if (written > 0) {
+            total += written;
+        }
+        if (written < ret) {
+            break;
+        }
+        // stop at a short read, or a pipe would wait for data that may never come
+        if (ret < size) {
+            break;
+        }
+    }
+
+    mem_free_page((uint32_t)buf, 1);
+    return total;
+}
+
+// copy up to count bytes from in_fd to out_fd inside the kernel
+// if offset is given, reading starts there and *offset is advanced instead of the file position
+// returns the number of bytes copied, 0 at the end of in_fd
+int sys_sendfile(int out_fd, int in_fd, int *offset, int count) {
+    if (is_invalid_fd(out_fd) || is_invalid_fd(in_fd) || count < 0) {
+        return -1;
+    }
+
+    file_t *out = task_file(out_fd);
+    file_t *in = task_file(in_fd);
+    if (!out || !in) {
+        log_printf("file not opened");
+        return -1;
+    }
+
+    if (in->mode == O_WRONLY || out->mode == O_RDONLY) {
+        log_printf("wrong file mode for sendfile");
+        return -1;
+    }
+
+    if (in->type != FILE_NORMAL) {
+        if (offset) {
+            return -1; // there is no position to start from
+        }
+        return sendfile_buffered(out, in, count);
+    }
+
+    if (offset) {
+        vma_prefault((uint32_t)offset, sizeof(int), 1);
+    }
+    uint32_t pos = offset ? *offset : in->pos;
+    int total = sendfile_cached(out, in, pos, count);
+    if (offset) {
+        *offset = pos + total;
+    } else if (total > 0) {
+        file_protect(in);
+        in->fs->op->seek(in, pos + total, SEEK_SET);
+        file_unprotect(in);
+    }
+
+    return total;
+}
+
 int sys_close(int file) {
     // if (file == TEMP_FILE_ID) {
     //     return 0;
@@ -270,15 +532,22 @@ int sys_close(int file) {
     }
 
     task_remove_fd(file);
+    fs_close_file(fp);
+    return 0;
+}
 
-    if (--fp->ref > 0) {
-        return 0;
+// drop a reference of the file, it is closed by the last user
+// (fds and mappings both hold references)
+void fs_close_file(file_t *file) {
+    if (file->ref > 1) {
+        file_free(file);
+        return;
     }
 
-    fs_protect(fp->fs);
-    fp->fs->op->close(fp);
-    fs_unprotect(fp->fs);
-    return 0;
+    fs_protect(file->fs);
+    file->fs->op->close(file);
+    fs_unprotect(file->fs);
+    file_free(file); // the entry is reused only after it is closed
 }
 
 int sys_isatty(int file) {
@@ -425,10 +694,24 @@ mount_failed:
     return (fs_t*)0;
 }
 
-int sys_opendir(const char *path, DIR *dir) {
-    fs_protect(root_fs);
-    int ret = root_fs->op->opendir(root_fs, path, dir);
-    fs_unprotect(root_fs);
+// readdir and closedir work on root_fs, so only directories there can be opened
+int sys_opendir(const char *name, DIR *dir) {
+    vma_prefault_str(name);
+    vma_prefault((uint32_t)dir, sizeof(DIR), 1);
+
+    const char *path;
+    fs_t *fs = mount_lookup(name, &path);
+    if (fs != root_fs || !fs->op->opendir) {
+        log_printf("%s is not a directory of root fs", name);
+        return -1;
+    }
+    if (!path) {
+        path = "/"; // the mount point itself
+    }
+
+    fs_protect(fs);
+    int ret = fs->op->opendir(fs, path, dir);
+    fs_unprotect(fs);
     return ret;
 }
 
@@ -436,6 +719,7 @@ int sys_opendir(const char *path, DIR *dir) {
 // => since there may be many different file systems
 // => their behaviors may be different
 int sys_readdir(DIR *dir) {
+    vma_prefault((uint32_t)dir, sizeof(DIR), 1);
     fs_protect(root_fs);
     int ret = root_fs->op->readdir(root_fs, dir);
     fs_unprotect(root_fs);
@@ -449,16 +733,45 @@ int sys_closedir(DIR *dir) {
     return ret;
 }
 
+// the file lock comes before the fs lock, so the file is looked up first and
+// unlink checks that the name still refers to it
 int sys_unlink(const char *file_name) {
-    fs_protect(root_fs);
-    int ret = root_fs->op->unlink(root_fs, file_name);
-    fs_unprotect(root_fs);
+    vma_prefault_str(file_name);
+    fs_t *fs = root_fs;
+    if (!fs->op->lookup || !fs->op->unlink) {
+        return -1;
+    }
+
+    int ret;
+    do {
+        uint32_t ino;
+        fs_protect(fs);
+        ret = fs->op->lookup(fs, file_name, &ino);
+        fs_unprotect(fs);
+        if (ret < 0) {
+            return -1;
+        }
+
+        mutex_t *lock = file_lock_of_ino(fs, ino);
+        mutex_lock(lock);
+        fs_protect(fs);
+        ret = fs->op->unlink(fs, file_name, ino);
+        fs_unprotect(fs);
+        mutex_unlock(lock);
+    } while (ret == FS_ERR_RETRY);
+
     return ret;
 }
 
 void fs_init(void) {
     disk_init();
     file_table_init();
+    pcache_init();
+    path_cache_init();
+    pipe_init();
+    for (int i = 0; i < FILE_LOCK_NUM; i++) {
+        mutex_init(&file_locks[i]);
+    }
     // i think we also need to pass into FS_DEVFS is because of efficiency
     // without this lead to many if and else if (comparison of strings)
     fs_t *fs = mount(FS_DEVFS, "/dev", 0, 0);
@@ -0,0 +1,79 @@
+#include "fs/pathcache.h"
+#include "ipc/mutex.h"
+#include "tools/klib.h"
+
+// path cache of VFS: full path => (fs, ino), so that opening the same path again
+// skips both the mount table scan and the directory lookup of file system
+static path_cache_t path_cache[PATH_CACHE_SIZE];
+static mutex_t path_cache_mutex;
+
+static path_cache_t *path_cache_slot(const char *path) {
+    uint32_t hash = 0;
+    while (*path) {
+        hash = hash * 31 + (uint8_t)*path++;
+    }
+    return path_cache + hash % PATH_CACHE_SIZE;
+}
+
+void path_cache_init(void) {
+    kernel_memset(path_cache, 0, sizeof(path_cache));
+    mutex_init(&path_cache_mutex);
+}
+
+// returns 1 if found, -1 if the path is known not to exist, 0 if not cached
+int path_cache_lookup(const char *path, struct _fs_t **fs, uint32_t *ino) {
+    if (kernel_strlen(path) >= PATH_CACHE_NAME_SIZE) {
+        return 0;
+    }
+
+    int ret = 0;
+    mutex_lock(&path_cache_mutex);
+    path_cache_t *entry = path_cache_slot(path);
+    if (entry->fs && kernel_strncmp(entry->path, path, PATH_CACHE_NAME_SIZE) == 0) {
+        *fs = entry->fs;
+        *ino = entry->ino;
+        ret = entry->negative ? -1 : 1;
+    }
+    mutex_unlock(&path_cache_mutex);
+    return ret;
+}
+
+// the previous entry in the same slot is replaced
+void path_cache_add(const char *path, struct _fs_t *fs, uint32_t ino, int negative) {
+    if (kernel_strlen(path) >= PATH_CACHE_NAME_SIZE) {
+        return;
+    }
+
+    mutex_lock(&path_cache_mutex);
+    path_cache_t *entry = path_cache_slot(path);
+    kernel_strncpy(entry->path, path, PATH_CACHE_NAME_SIZE);
+    entry->fs = fs;
+    entry->ino = ino;
+    entry->negative = negative;
+    mutex_unlock(&path_cache_mutex);
+}
+
+// the file is removed, every path leading to it is dropped
+void path_cache_remove(struct _fs_t *fs, uint32_t ino) {
+    mutex_lock(&path_cache_mutex);
+    for (int i = 0; i < PATH_CACHE_SIZE; i++) {
+        path_cache_t *entry = path_cache + i;
+        if (entry->fs == fs && entry->ino == ino && !entry->negative) {
+            entry->fs = (struct _fs_t*)0;
+        }
+    }
+    mutex_unlock(&path_cache_mutex);
+}
+
+// a file is created in fs, the paths known not to exist may exist now
+// (the same file can be named by different paths, so all of them are dropped)
+void path_cache_remove_negative(struct _fs_t *fs) {
+    mutex_lock(&path_cache_mutex);
+    for (int i = 0; i < PATH_CACHE_SIZE; i++) {
+        path_cache_t *entry = path_cache + i;
+        if (entry->fs == fs && entry->negative) {
+            entry->fs = (struct _fs_t*)0;
+        }
+    }
+    mutex_unlock(&path_cache_mutex);
+}
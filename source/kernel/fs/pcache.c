@@ -0,0 +1,190 @@
+#include "fs/pcache.h"
+#include "fs/fs.h"
+#include "core/memory.h"
+#include "ipc/mutex.h"
+#include "tools/klib.h"
+
+// page cache: pages of file data shared by every mapping of the same file
+// pages are found with a hash of (fs, ino, index) and replaced with clock algorithm
+static pcache_page_t pcache_table[PCACHE_SIZE];
+static short pcache_hash[PCACHE_HASH_SIZE]; // first slot of every bucket, -1 if empty
+static int pcache_hand; // clock hand
+static mutex_t pcache_mutex;
+
+static uint32_t pcache_hash_index(struct _fs_t *fs, uint32_t ino, uint32_t index) {
+    return ((uint32_t)fs + ino * 31 + index) % PCACHE_HASH_SIZE;
+}
+
+void pcache_init(void) {
+    mutex_init(&pcache_mutex);
+    kernel_memset(pcache_table, 0, sizeof(pcache_table));
+    for (int i = 0; i < PCACHE_HASH_SIZE; i++) {
+        pcache_hash[i] = -1;
+    }
+    pcache_hand = 0;
+}
+
+static pcache_page_t *pcache_find(struct _fs_t *fs, uint32_t ino, uint32_t index) {
+    int i = pcache_hash[pcache_hash_index(fs, ino, index)];
+    while (i >= 0) {
+        pcache_page_t *page = pcache_table + i;
+        if (page->fs == fs && page->ino == ino && page->index == index) {
+            return page;
+        }
+        i = page->next;
+    }
+    return (pcache_page_t*)0;
+}
+
+// remove the page from cache, the physical page is freed when no task maps it
+static void pcache_drop(pcache_page_t *page) {
+    short *link = pcache_hash + pcache_hash_index(page->fs, page->ino, page->index);
+    while (*link >= 0) {
+        if (pcache_table + *link == page) {
+            *link = page->next;
+            break;
+        }
+        link = &pcache_table[*link].next;
+    }
+
+    mem_free_page(page->paddr, 1);
+    page->fs = (struct _fs_t*)0;
+}
+
+// find a slot for a new page
+// the first round clears the referenced bits, and pages still mapped by tasks are kept,
+// otherwise two mappings of the same file could end up with different pages
+static pcache_page_t *pcache_alloc_slot(void) {
+    for (int i = 0; i < PCACHE_SIZE * 2; i++) {
+        pcache_page_t *page = pcache_table + pcache_hand;
+        pcache_hand = (pcache_hand + 1) % PCACHE_SIZE;
+        if (!page->fs) {
+            return page;
+        }
+        if (page->referenced) {
+            page->referenced = 0;
+            continue;
+        }
+        if (mem_page_refcount(page->paddr) > 1) {
+            continue;
+        }
+
+        pcache_drop(page);
+        return page;
+    }
+
+    return (pcache_page_t*)0;
+}
+
+// returns the physical page holding the "index"-th page of file, 0 if failed
+// the caller owns one reference of the page and releases it with mem_free_page
+// if the cache is full of mapped pages, the page is returned without being cached
+static uint32_t pcache_get_page(file_t *file, uint32_t index, int exec) {
+    mutex_lock(&pcache_mutex);
+    pcache_page_t *page = pcache_find(file->fs, file->ino, index);
+    if (page) {
+        page->referenced = 1;
+        page->exec |= exec;
+        mem_page_ref(page->paddr);
+        mutex_unlock(&pcache_mutex);
+        return page->paddr;
+    }
+    mutex_unlock(&pcache_mutex);
+
+    // the lock is not held while reading the file, since file systems call into
+    // the page cache with their own lock held (unlink, truncate)
+    // bytes beyond the end of file are zeroes
+    uint32_t paddr = mem_alloc_zero_page();
+    if (!paddr) {
+        return 0;
+    }
+
+    uint32_t offset = index * MEM_PAGE_SIZE;
+    if (offset < file->size) {
+        int size = file->size - offset;
+        if (size > MEM_PAGE_SIZE) {
+            size = MEM_PAGE_SIZE;
+        }
+        if (fs_read_at(file, (char*)paddr, size, offset) < 0) {
+            mem_free_page(paddr, 1);
+            return 0;
+        }
+    }
+
+    mutex_lock(&pcache_mutex);
+    // the same page may have been cached while the lock was released
+    page = pcache_find(file->fs, file->ino, index);
+    if (page) {
+        page->referenced = 1;
+        page->exec |= exec;
+        mem_page_ref(page->paddr);
+        mutex_unlock(&pcache_mutex);
+        mem_free_page(paddr, 1);
+        return page->paddr;
+    }
+
+    page = pcache_alloc_slot();
+    if (page) {
+        uint32_t hash = pcache_hash_index(file->fs, file->ino, index);
+        page->fs = file->fs;
+        page->ino = file->ino;
+        page->index = index;
+        page->paddr = paddr;
+        page->referenced = 1;
+        page->exec = exec;
+        page->next = pcache_hash[hash];
+        pcache_hash[hash] = page - pcache_table;
+        mem_page_ref(paddr);
+    }
+    mutex_unlock(&pcache_mutex);
+
+    return paddr;
+}
+
+uint32_t pcache_get(file_t *file, uint32_t index) {
+    return pcache_get_page(file, index, 0);
+}
+
+// same as pcache_get, but the page is used as text of a program
+// (shared by every task running the same file)
+uint32_t pcache_get_exec(file_t *file, uint32_t index) {
+    return pcache_get_page(file, index, 1);
+}
+
+// keep the cached pages up to date with data written by sys_write
+// text pages are dropped instead, running programs keep the old pages and
+// the next exec reads the new data
+void pcache_write(file_t *file, uint32_t offset, const char *buf, int size) {
+    mutex_lock(&pcache_mutex);
+    while (size > 0) {
+        int page_offset = offset % MEM_PAGE_SIZE;
+        int count = MEM_PAGE_SIZE - page_offset;
+        if (count > size) {
+            count = size;
+        }
+
+        pcache_page_t *page = pcache_find(file->fs, file->ino, offset / MEM_PAGE_SIZE);
+        if (page && page->exec) {
+            pcache_drop(page);
+        } else if (page) {
+            kernel_memcpy((char*)page->paddr + page_offset, buf, count);
+        }
+
+        offset += count;
+        buf += count;
+        size -= count;
+    }
+    mutex_unlock(&pcache_mutex);
+}
+
+// drop every cached page of a file, called when the data of file is gone (unlink, truncate)
+void pcache_invalidate(struct _fs_t *fs, uint32_t ino) {
+    mutex_lock(&pcache_mutex);
+    for (int i = 0; i < PCACHE_SIZE; i++) {
+        pcache_page_t *page = pcache_table + i;
+        if (page->fs == fs && page->ino == ino) {
+            pcache_drop(page);
+        }
+    }
+    mutex_unlock(&pcache_mutex);
+}
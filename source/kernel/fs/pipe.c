@@ -0,0 +1,228 @@
+#include "fs/pipe.h"
+#include "fs/fs.h"
+#include "core/task.h"
+#include "core/memory.h"
+#include "core/vma.h"
+#include "cpu/cpu.h"
+#include "tools/klib.h"
+#include "tools/log.h"
+#include <sys/file.h>
+
+// pipes are not mounted anywhere, both ends point to this fs so that
+// sys_read/sys_write and close go through the same fs_op_t as the other files
+// there is no fs mutex, the pipe state is protected by disabling interrupts
+extern fs_op_t pipefs_op;
+static fs_t pipe_fs = {
+    .op = &pipefs_op,
+};
+
+static pipe_t pipe_table[PIPE_NUM];
+
+void pipe_init(void) {
+    kernel_memset(pipe_table, 0, sizeof(pipe_table));
+    for (int i = 0; i < PIPE_NUM; i++) {
+        list_init(&pipe_table[i].read_wait);
+        list_init(&pipe_table[i].write_wait);
+    }
+}
+
+// must be called with interrupts disabled, same as sem_wait does
+// the condition is checked again after waking up
+static void pipe_wait(list_t *wait_list) {
+    task_t *curr = task_current();
+    task_set_unready(curr);
+    list_insert_last(wait_list, &curr->run_node);
+    task_dispatch();
+}
+
+static void pipe_wake(list_t *wait_list) {
+    while (list_count(wait_list) > 0) {
+        list_node_t *node = list_first(wait_list);
+        list_remove_first(wait_list);
+        task_set_ready(parent_pointer(task_t, run_node, node));
+    }
+}
+
+static pipe_t *pipe_alloc(void) {
+    char *buf = (char*)mem_alloc_page(1);
+    if (!buf) {
+        return (pipe_t*)0;
+    }
+
+    irq_state_t state = irq_enter_protection();
+    for (int i = 0; i < PIPE_NUM; i++) {
+        pipe_t *pipe = pipe_table + i;
+        if (!pipe->used) {
+            pipe->used = 1;
+            pipe->readers = 1;
+            pipe->writers = 1;
+            fifo_init(&pipe->fifo, buf, PIPE_BUF_SIZE);
+            irq_leave_protection(state);
+            return pipe;
+        }
+    }
+    irq_leave_protection(state);
+
+    mem_free_page((uint32_t)buf, 1);
+    return (pipe_t*)0;
+}
+
+int sys_pipe(int *fds) {
+    file_t *rfile = (file_t*)0, *wfile = (file_t*)0;
+    int rfd = -1, wfd = -1;
+
+    vma_prefault((uint32_t)fds, sizeof(int) * 2, 1);
+    pipe_t *pipe = pipe_alloc();
+    if (!pipe) {
+        log_printf("no pipe available");
+        return -1;
+    }
+
+    rfile = file_alloc();
+    wfile = file_alloc();
+    if (!rfile || !wfile) {
+        goto sys_pipe_failed;
+    }
+
+    rfd = task_alloc_fd(rfile);
+    if (rfd < 0) {
+        goto sys_pipe_failed;
+    }
+    wfd = task_alloc_fd(wfile);
+    if (wfd < 0) {
+        goto sys_pipe_failed;
+    }
+
+    rfile->type = wfile->type = FILE_PIPE;
+    rfile->fs = wfile->fs = &pipe_fs;
+    rfile->dev_id = wfile->dev_id = pipe - pipe_table;
+    rfile->mode = O_RDONLY;
+    wfile->mode = O_WRONLY;
+    kernel_strncpy(rfile->file_name, "pipe", FILE_NAME_SIZE);
+    kernel_strncpy(wfile->file_name, "pipe", FILE_NAME_SIZE);
+
+    fds[0] = rfd;
+    fds[1] = wfd;
+    return 0;
+
+sys_pipe_failed:
+    if (rfd >= 0) {
+        task_remove_fd(rfd);
+    }
+    if (wfd >= 0) {
+        task_remove_fd(wfd);
+    }
+    if (rfile) {
+        file_free(rfile);
+    }
+    if (wfile) {
+        file_free(wfile);
+    }
+    mem_free_page((uint32_t)pipe->fifo.buf, 1);
+    pipe->used = 0;
+    return -1;
+}
+
+static int pipefs_mount(fs_t *fs, int major, int minor) {
+    return -1;
+}
+
+static void pipefs_unmount(fs_t *fs) {
+
+}
+
+static int pipefs_open(fs_t *fs, const char *path, file_t *file) {
+    return -1;
+}
+
+// blocks until there is some data, returns 0 when it is empty and all writers are closed
+static int pipefs_read(char *buf, int size, file_t *file) {
+    pipe_t *pipe = pipe_table + file->dev_id;
+
+    irq_state_t state = irq_enter_protection();
+    while (pipe->fifo.count == 0 && pipe->writers > 0) {
+        pipe_wait(&pipe->read_wait);
+    }
+
+    int count = fifo_get_bulk(&pipe->fifo, buf, size);
+    if (count > 0) {
+        pipe_wake(&pipe->write_wait);
+    }
+    irq_leave_protection(state);
+    return count;
+}
+
+// blocks until everything is written, stops early when all readers are closed
+static int pipefs_write(char *buf, int size, file_t *file) {
+    pipe_t *pipe = pipe_table + file->dev_id;
+    int total = 0;
+
+    irq_state_t state = irq_enter_protection();
+    while (total < size) {
+        while (pipe->fifo.count == pipe->fifo.size && pipe->readers > 0) {
+            pipe_wait(&pipe->write_wait);
+        }
+
+        if (pipe->readers == 0) {
+            break;
+        }
+
+        int count = fifo_put_bulk(&pipe->fifo, buf + total, size - total);
+        total += count;
+        pipe_wake(&pipe->read_wait);
+    }
+    irq_leave_protection(state);
+
+    return total > 0 ? total : -1;
+}
+
+// called for the last reference of an end
+static void pipefs_close(file_t *file) {
+    pipe_t *pipe = pipe_table + file->dev_id;
+
+    irq_state_t state = irq_enter_protection();
+    if (file->mode == O_RDONLY) {
+        pipe->readers--;
+    } else {
+        pipe->writers--;
+    }
+
+    // the other side may be waiting for an end that never comes
+    pipe_wake(&pipe->read_wait);
+    pipe_wake(&pipe->write_wait);
+
+    char *buf = (char*)0;
+    if (pipe->readers == 0 && pipe->writers == 0) {
+        buf = pipe->fifo.buf;
+        pipe->used = 0;
+    }
+    irq_leave_protection(state);
+
+    if (buf) {
+        mem_free_page((uint32_t)buf, 1);
+    }
+}
+
+static int pipefs_seek(file_t *file, int offset, int dir) {
+    return -1;
+}
+
+static int pipefs_stat(file_t *file, struct stat *st) {
+    return -1;
+}
+
+static int pipefs_ioctl(file_t *file, int cmd, int arg0, int arg1) {
+    return -1;
+}
+
+fs_op_t pipefs_op = {
+    .mount = pipefs_mount,
+    .unmount = pipefs_unmount,
+    .open = pipefs_open,
+    .read = pipefs_read,
+    .write = pipefs_write,
+    .close = pipefs_close,
+    .seek = pipefs_seek,
+    .stat = pipefs_stat,
+    .ioctl = pipefs_ioctl,
+};
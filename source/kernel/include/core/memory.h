@@ -5,19 +5,23 @@
 #include "comm/types.h"
 #include "ipc/mutex.h"
 #include "comm/boot_info.h"
+#include "cpu/mmu.h"
 
 #define PDE_CNT 1024
 #define PTE_CNT 1024
 #define MEM_PAGE_SIZE (4096)
 #define MEM_TASK_BASE (0x80000000) // above is space for tasks
 
+#define MEM_TASK_MMAP_START 0xC0000000 // mmap places files from here up to the stack
 #define MEM_TASK_STACK_TOP 0xE0000000
 #define MEM_TASK_STACK_SIZE (MEM_PAGE_SIZE * 500)
 #define MEM_TASK_ARG_SIZE (MEM_PAGE_SIZE * 4)
+#define MEM_ZERO_POOL_SIZE 32 // pages kept zeroed by the idle task
 
 typedef struct {
     mutex_t mutex;
     bitmap_t bitmap;
+    uint16_t *page_ref; // reference count of every page, a page is freed when it drops to zero
     uint32_t start; // the start address managed by allocator
     uint32_t size; // the size of memory managed by allocator
     uint32_t page_size;
@@ -34,9 +38,17 @@ void memory_init(boot_info_t *boot_info);
 uint32_t memory_create_uvm(void);
 int alloc_mem_for_task(uint32_t page_dir, uint32_t page_count, uint32_t vstart, uint32_t perm);
 uint32_t mem_alloc_page(int page_count);
+uint32_t mem_alloc_zero_page(void);
+void memory_fill_zero_pool(void);
 void mem_free_page(uint32_t addr, int page_count);
-uint32_t memory_copy_uvm(uint32_t page_dir);
+void mem_page_ref(uint32_t paddr);
+int mem_page_refcount(uint32_t paddr);
+pte_t *find_pte(pde_t *page_dir, uint32_t vstart, int alloc);
+void memory_set_pte(pte_t *pte, uint32_t v);
+void memory_unmap_page(pde_t *page_dir, uint32_t vaddr);
+int memory_create_map(pde_t *page_dir, uint32_t vstart, uint32_t pstart, int page_count, uint32_t perm);
 void memory_destroy_uvm(uint32_t page_dir);
+int memory_user_pages(uint32_t page_dir);
 uint32_t memory_get_paddr(uint32_t page_dir, uint32_t vaddr);
 int memory_copy_uvm_data(uint32_t to, uint32_t page_dir, uint32_t from, uint32_t size);
 char *sys_sbrk(int incr);
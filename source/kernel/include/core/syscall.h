@@ -32,6 +32,15 @@
 #define SYS_readdir 61
 #define SYS_closedir 62
 #define SYS_unlink 63
+#define SYS_mmap 64
+#define SYS_munmap 65
+#define SYS_pipe 66
+#define SYS_sendfile 67
+#define SYS_dmesg 68
+#define SYS_trace 69
+#define SYS_prof 70
+#define SYS_ps 71
+#define SYS_get_clock 72
 
 
 #define SYS_print_msg 100
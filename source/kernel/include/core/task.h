@@ -4,8 +4,8 @@
 #include "cpu/cpu.h"
 #include "tools/list.h"
 #include "fs/file.h"
+#include "core/task_stat.h"
 
-#define TASK_NAME_SIZE 32
 #define TASK_TIME_TICKS_DEFAULT 10
 #define MAIN_TASK_PAGE 10
 #define TASK_FLAG_SYSTEM 1
@@ -39,6 +39,14 @@ typedef struct _task_t {
     uint32_t heap_end;
 
     file_t *file_table[OPEN_FILE_NUM];
+    uint32_t fd_map[OPEN_FILE_NUM / 32]; // bit set => fd is used
+    struct _vma_t *vmas; // regions of user space sorted by address, see core/vma.h
+    int vma_count;
+
+    task_stat_t stat;
+    uint64_t acct_tsc; // time up to here is in stat
+    int in_kernel; // time since acct_tsc goes to stime
+    int system; // TASK_FLAG_SYSTEM, always in kernel
 }task_t;
 
 typedef struct {
@@ -59,6 +67,7 @@ typedef struct _task_args_t {
 }task_args_t;
 
 int task_init(task_t *task, const char *name, int flag, uint32_t entry, uint32_t esp);
+void task_start(task_t *task);
 void task_switch_from_to(task_t *from, task_t *to);
 void task_manager_init(void);
 void main_task_init(void);
@@ -79,6 +88,9 @@ void sys_print_msg(const char *fmt, int arg);
 int sys_execve(char *name, char **argv, char **env);
 void sys_exit(int status);
 int sys_wait(int *status);
+int sys_ps(task_info_t *infos, int count, task_clock_t *clock);
+void task_syscall_enter(void);
+void task_syscall_exit(void);
 
 file_t *task_file(int fd);
 int task_alloc_fd(file_t *file);
@@ -0,0 +1,41 @@
+#ifndef TASK_STAT_H
+#define TASK_STAT_H
+
+#include "comm/types.h"
+
+// what sys_ps hands to user programs, kept apart from task.h
+// so that they don't see the kernel's task_t
+
+#define TASK_NAME_SIZE 32
+
+// cpu time is counted in tsc cycles, sys_ps gives a clock to turn it into ms
+typedef struct _task_stat_t {
+    uint64_t utime;
+    uint64_t stime; // in syscalls, or any time for system tasks
+    uint32_t nvcsw; // gave up the cpu (sleep, wait, yield...)
+    uint32_t nivcsw; // time slice used up
+    uint32_t syscalls;
+    uint32_t faults;
+    uint32_t read_bytes;
+    uint32_t write_bytes;
+    uint64_t exec_cycles; // last execve, from the call to the first instruction of the program
+}task_stat_t;
+
+// one entry filled by sys_ps
+typedef struct _task_info_t {
+    uint32_t pid;
+    uint32_t ppid;
+    int state;
+    char name[TASK_NAME_SIZE];
+    uint32_t rss; // pages mapped in user space
+    task_stat_t stat;
+}task_info_t;
+
+// tsc cycles and ticks since the timer was started, cycles per ms = tsc / (ticks * tick_ms)
+typedef struct _task_clock_t {
+    uint64_t tsc;
+    uint32_t ticks;
+    uint32_t tick_ms;
+}task_clock_t;
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef VMA_H
+#define VMA_H
+
+#include "comm/types.h"
+#include "fs/file.h"
+
+// same values as user space (applib/lib_syscall.h)
+#ifndef PROT_READ
+#define PROT_READ 1
+#define PROT_WRITE 2
+#define PROT_EXEC 4
+#define MAP_SHARED 1
+#define MAP_PRIVATE 2
+#endif
+
+// segment of a program, cached pages are dropped instead of updated when the file is written
+#define VMA_IMAGE (1 << 4)
+#define VMA_HEAP (1 << 5) // grown by sbrk
+
+// a mapped region of user space, [start, end) is page aligned
+typedef struct _vma_t {
+    uint32_t start;
+    uint32_t end;
+    int prot;
+    int flags;
+    file_t *file;
+    uint32_t offset; // file offset of start
+    uint32_t file_end; // data beyond this address is not from file but zeroes (bss)
+}vma_t;
+
+// vmas of a task are kept sorted in one page, allocated on the first mapping
+#define TASK_VMA_NUM (4096 / sizeof(vma_t))
+
+struct _task_t;
+int vma_copy(struct _task_t *from, struct _task_t *to);
+void vma_destroy(struct _task_t *task);
+int vma_handle_fault(uint32_t vaddr, int write);
+void vma_prefault(uint32_t start, int size, int write);
+void vma_prefault_str(const char *str);
+int vma_map_image(struct _task_t *task, uint32_t vaddr, uint32_t memsz, int prot,
+                  file_t *file, uint32_t offset, uint32_t filesz);
+void vma_discard(struct _task_t *task);
+int vma_map_anon(struct _task_t *task, uint32_t start, uint32_t size, int prot, int flags);
+int vma_set_heap(struct _task_t *task, uint32_t start, uint32_t end);
+
+int sys_mmap(uint32_t len, int prot_flags, int fd, uint32_t offset);
+int sys_munmap(void *addr, uint32_t len);
+
+#endif
@@ -116,6 +116,7 @@ void switch_to_tss(int tss_sel);
 
 #define IRQ0_TIMER          0x20
 #define IRQ1_KEYBOARD       0x21
+#define IRQ4_COM1           0x24
 #define IRQ14_DISK_PRIMARY  0x2E 
 
 #define PIC0_ICW1			0x20
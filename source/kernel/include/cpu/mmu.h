@@ -10,6 +10,13 @@
 #define PDE_U (1 << 2)
 #define PDE_W (1 << 1)
 #define PTE_U (1 << 2)
+#define PTE_D (1 << 6)
+// available bit for os: the page belongs to page cache (shared with other mappings)
+#define PTE_SHARE (1 << 9)
+
+// when set, supervisor writes to read-only user pages fault as well
+// (needed by copy on write, otherwise kernel could write into shared pages)
+#define CR0_WP (1 << 16)
 
 // useful links for union:
 // basically it is used to save memory
@@ -74,6 +81,11 @@ static inline uint32_t pte_paddr (pte_t * pte) {
     return pte->phy_page_addr << 12;
 }
 
+// reload cr3 so that the modified ptes take effect
+static inline void mmu_flush_tlb(void) {
+    write_cr3(read_cr3());
+}
+
 #endif
 
 
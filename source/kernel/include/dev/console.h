@@ -13,6 +13,8 @@
 #define ASCII_ESC 0x1b
 
 #define ESC_PARAM_MAX 10
+#define CONSOLE_CHUNK_SIZE 128 // chars taken from the tty fifo at once
+#define CONSOLE_SCROLLBACK_PAGES 4 // history of each console, about 200 rows of plain text
 
 typedef enum {
     COLOR_BLACK = 0,
@@ -49,7 +51,15 @@ typedef struct _console_t {
         CONSOLE_WRITE_SEQ,
     }write_state;
 
-    disp_char_t *disp_base;
+    disp_char_t *disp_base; // vga memory of the console
+    disp_char_t shadow[CONSOLE_ROW * CONSOLE_COL]; // text is drawn here and copied to disp_base
+    int top_row; // row of shadow shown at the top of the screen
+    uint32_t dirty_rows; // bit set => screen row differs from vga memory
+    uint8_t *sb_buf; // scrollback ring, allocated when the console is opened
+    int sb_size;
+    int sb_head, sb_tail; // oldest record, where the next one is written
+    int sb_used, sb_lines; // bytes and rows in the ring
+    int view_offset; // rows the view is moved back in history, 0 => live screen
     int cursor_row, cursor_col;
     int disp_rows, disp_cols;
     color_t foreground, background;
@@ -61,7 +71,9 @@ typedef struct _console_t {
 
 int console_init(int idx);
 int console_write(tty_t *tty);
+void console_update_cursor(tty_t *tty);
 void console_close(int console);
 void console_select(int idx);
+void console_scroll(int idx, int lines);
 
 #endif
\ No newline at end of file
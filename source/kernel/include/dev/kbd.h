@@ -24,6 +24,10 @@
 #define KEY_F11			(0x57)
 #define KEY_F12			(0x58)
 
+#define KEY_PAGE_UP 0x49 // after E0
+#define KEY_PAGE_DOWN 0x51
+#define KBD_SCROLL_LINES 12
+
 typedef struct _key_map_t {
     uint8_t normal;
     uint8_t func;
@@ -0,0 +1,55 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include "comm/types.h"
+#include "ipc/sem.h"
+#include "tools/buffer.h"
+
+#define SERIAL_NUM 1 // only COM1 (ttyS0)
+#define COM1_PORT 0x3F8
+
+#define SERIAL_OBUF_SIZE 4096
+#define SERIAL_IBUF_SIZE 512
+#define SERIAL_BATCH_SIZE 128 // chars put into the output fifo at once
+#define SERIAL_HW_FIFO_SIZE 16 // 16550 transmit fifo
+
+// registers of 16550 uart, offsets from port base
+#define UART_DATA 0 // rx/tx, divisor low byte when DLAB is set
+#define UART_IER 1 // interrupt enable, divisor high byte when DLAB is set
+#define UART_IIR 2 // interrupt identification (read), fifo control (write)
+#define UART_LCR 3
+#define UART_MCR 4
+#define UART_LSR 5
+
+#define UART_IER_RX (1 << 0)
+#define UART_IER_TX (1 << 1) // transmit holding register empty
+
+#define UART_IIR_NONE (1 << 0) // no interrupt pending
+#define UART_IIR_ID_MASK 0x0E
+#define UART_IIR_TX 0x02
+#define UART_IIR_RX 0x04
+#define UART_IIR_LINE 0x06
+#define UART_IIR_TIMEOUT 0x0C
+
+#define UART_LSR_DATA (1 << 0)
+#define UART_LSR_THRE (1 << 5)
+
+#define SERIAL_OCRLF (1 << 0) // send "\r\n" for '\n'
+#define SERIAL_IECHO (1 << 1) // send received chars back
+
+typedef struct _serial_t {
+    uint16_t port;
+    char obuf[SERIAL_OBUF_SIZE];
+    char ibuf[SERIAL_IBUF_SIZE];
+    fifo_t ofifo;
+    fifo_t ififo;
+    sem_t osem; // free slots of ofifo
+    sem_t isem; // chars in ififo
+    int tx_busy; // transmit interrupt is enabled and will send the rest of ofifo
+    int oflags;
+    int iflags;
+}serial_t;
+
+void exception_handler_serial(void);
+
+#endif
@@ -10,7 +10,15 @@
 #define PIT_LOAD_LOHI               (3 << 4)
 #define PIT_MODE3                   (3 << 1)
 
+#include "comm/types.h"
+#include "core/task_stat.h"
+
 void time_init(void);
+uint32_t time_get_ticks(void);
+void time_set_rate(int rate);
+uint64_t time_get_tsc(void);
+void time_read_clock(task_clock_t *clock);
+int sys_get_clock(task_clock_t *clock);
 void exception_handler_timer(void);
 
 #endif
\ No newline at end of file
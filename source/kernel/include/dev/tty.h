@@ -8,6 +8,7 @@
 
 #define TTY_OBUF_SIZE 512
 #define TTY_IBUF_SIZE 512
+#define TTY_BATCH_SIZE 128 // chars put into the output fifo at once
 
 #define TTY_OCRLF (1 << 0) // if this is turned on, then we send '\r''\n' to console layer
 // #define TTY_ICRLF (1 << 0) // don't think this is needed
@@ -39,5 +40,6 @@ int tty_fifo_get(fifo_t *fifo, char *c);
 int tty_fifo_put(fifo_t *fifo, char c);
 void tty_in(char c);
 void tty_select(int idx);
+void tty_scroll(int lines);
 
 #endif
\ No newline at end of file
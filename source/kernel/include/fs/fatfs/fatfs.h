@@ -2,9 +2,11 @@
 #define FATFS_H
 
 #include "ipc/mutex.h"
+#include "tools/bitmap.h"
 
 #define FAT_CLUSTER_INVALID 0xFFF8
 #define FAT_CLUSTER_FREE 0x00
+#define FAT_IO_MAX_SECTORS 0xFFFF // sector count of a single disk command is 16 bits
 
 #define DIRITEM_NAME_FREE 0xE5
 #define DIRITEM_NAME_END 0x00
@@ -18,6 +20,9 @@
 #define DIRITEM_ATTR_LONG_NAME 0x0F
 
 #define FORMAT_NAME_LEN 11
+#define FAT_DIR_HASH_SIZE 128 // buckets of the root directory index
+#define FAT_ROOT_DIR 0 // cluster number standing for the root directory, same as ".." in fat
+#define FAT_INO(dir, index) (((uint32_t)(dir) << 16) | (index)) // a file is identified by its entry
 
 #pragma pack(1)
 
@@ -63,6 +68,26 @@ typedef struct _dbr_t {
 } dbr_t;
 #pragma pack()
 
+// an entry of the in-memory root directory index, one per directory slot
+typedef struct _fat_dent_t {
+    uint8_t name[FORMAT_NAME_LEN];
+    uint8_t used;
+    uint8_t attr;
+    uint16_t cluster;
+    short next; // next slot in the same hash bucket, -1 if none
+}fat_dent_t;
+
+// lookup cache of subdirectories: (parent cluster, name) => entry
+// index -1 is a negative entry, which means the name is not in the directory
+typedef struct _fat_dcache_t {
+    uint8_t name[FORMAT_NAME_LEN];
+    uint8_t valid;
+    uint8_t attr;
+    uint16_t dir;
+    uint16_t cluster;
+    short index;
+}fat_dcache_t;
+
 typedef struct _fat_t {
     uint32_t tbl_start;                     
     uint32_t tbl_cnt;                       
@@ -75,6 +100,24 @@ typedef struct _fat_t {
     uint32_t cluster_byte_size;
     uint8_t *fat_buffer;
     uint32_t sector_idx; // absolute sector index
+
+    // the whole fat table is loaded into memory when mounting,
+    // so walking or allocating clusters never touches the disk
+    uint16_t *fat_table;
+    int fat_page_count; // pages holding the table and the two bitmaps
+    uint32_t cluster_cnt; // valid cluster numbers are 2 ~ cluster_cnt-1
+    uint32_t free_cnt;
+    uint32_t next_free; // search for free clusters starts from here
+    bitmap_t free_bitmap; // bit set => cluster is free
+    bitmap_t dirty_bitmap; // bit set => fat sector modified but not written back
+
+    // name hash index of the root directory, built when mounting
+    // and kept in sync by write_dir_entry
+    fat_dent_t *root_index;
+    short *root_hash; // first slot of every bucket, -1 if empty
+    bitmap_t root_free; // bit set => directory slot is free
+    int root_page_count;
+    fat_dcache_t *dcache; // direct mapped, one page
     struct _fs_t *fs;
     mutex_t mutex; 
 } fat_t;
@@ -11,6 +11,7 @@ typedef enum _file_type_t {
     FILE_TTY,
     FILE_DIR,
     FILE_NORMAL,
+    FILE_PIPE,
 }file_type_t;
 
 struct _fs_t;
@@ -22,9 +23,14 @@ typedef struct _file_t {
     int dev_id;
     int pos;
     int mode;
-    int p_index; // index in root directory
+    int p_index; // index in parent directory
+    uint16_t p_dir; // cluster of parent directory, FAT_ROOT_DIR for root
+    uint32_t ino; // identity of the file in its file system, used by page cache
     uint16_t cblk;
     uint16_t sblk;
+    // cluster map built lazily by seek: cmap[i] is the i-th cluster of the chain
+    uint16_t *cmap;
+    int cmap_cnt;
 
     struct _fs_t *fs;
 }file_t;
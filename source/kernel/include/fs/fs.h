@@ -10,25 +10,41 @@
 
 #define FS_MOUNT_POINT_SIZE 128
 
+// "dir" argument of lseek
+#ifndef SEEK_SET
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
+#endif
+
 struct _fs_t;
 
 typedef struct _fs_op_t {
     int (*mount)(struct _fs_t *fs, int major, int minor);
     void (*unmount)(struct _fs_t *fs);
     int (*open)(struct _fs_t *fs, const char *path, file_t *file);
+    // open by file->ino of an earlier open, optional (path cache is not used without it)
+    int (*open_ino)(struct _fs_t *fs, uint32_t ino, file_t *file);
     int (*read)(char *buf, int size, file_t *file);
     int (*write)(char *buf, int size, file_t *file);
     void (*close)(file_t *file);
-    int (*seek)(file_t *file, uint32_t offset, int dir);
+    int (*seek)(file_t *file, int offset, int dir);
     int (*stat)(file_t *file, struct stat *st);
     int (*ioctl)(file_t *file, int cmd, int arg0, int arg1);
 
     int (*opendir)(struct _fs_t *fs, const char *name, DIR *dir);
     int (*readdir)(struct _fs_t *fs, DIR *dir);
     int (*closedir)(struct _fs_t *fs, DIR *dir);
-    int (*unlink)(struct _fs_t *fs, const char *file_name);
+    // the ino that file_name refers to now, so its file lock can be taken before unlink
+    int (*lookup)(struct _fs_t *fs, const char *file_name, uint32_t *ino);
+    // FS_ERR_RETRY if file_name isn't ino any more
+    int (*unlink)(struct _fs_t *fs, const char *file_name, uint32_t ino);
+    // cut an opened file to 0 bytes, called with both its file lock and the fs lock held
+    int (*truncate)(file_t *file);
 }fs_op_t;
 
+#define FS_ERR_RETRY -2 // the entry changed between lookup and the operation
+
 typedef enum _fs_type_t {
     FS_DEVFS,
     FS_FAT16,
@@ -62,6 +78,11 @@ int sys_fstat(int file, struct stat *st);
 int sys_dup(int file);
 int sys_ioctl (int file, int cmd, int arg0, int arg1);
 int sys_unlink(const char *file_name);
+int sys_sendfile(int out_fd, int in_fd, int *offset, int count);
+
+int fs_read_at(file_t *file, char *buf, int size, uint32_t offset);
+int fs_write_at(file_t *file, char *buf, int size, uint32_t offset);
+void fs_close_file(file_t *file);
 
 int sys_opendir(const char *path, DIR *dir);
 int sys_readdir(DIR *dir);
@@ -0,0 +1,25 @@
+#ifndef PATHCACHE_H
+#define PATHCACHE_H
+
+#include "comm/types.h"
+
+#define PATH_CACHE_SIZE 64 // direct mapped by the hash of path
+#define PATH_CACHE_NAME_SIZE 64 // longer paths are not cached
+
+struct _fs_t;
+
+// result of an earlier open: the path is in fs, and is the file "ino" of it (or doesn't exist)
+typedef struct _path_cache_t {
+    char path[PATH_CACHE_NAME_SIZE];
+    struct _fs_t *fs; // null => unused
+    uint32_t ino;
+    uint8_t negative; // the path doesn't exist
+}path_cache_t;
+
+void path_cache_init(void);
+int path_cache_lookup(const char *path, struct _fs_t **fs, uint32_t *ino);
+void path_cache_add(const char *path, struct _fs_t *fs, uint32_t ino, int negative);
+void path_cache_remove(struct _fs_t *fs, uint32_t ino);
+void path_cache_remove_negative(struct _fs_t *fs);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef PCACHE_H
+#define PCACHE_H
+
+#include "comm/types.h"
+#include "fs/file.h"
+
+#define PCACHE_SIZE 256 // pages kept in page cache
+#define PCACHE_HASH_SIZE 64
+
+struct _fs_t;
+
+// a page of file data, identified by (fs, ino, index)
+// the cache holds one reference of the physical page,
+// so a page mapped by tasks stays alive even after it is dropped from the cache
+typedef struct _pcache_page_t {
+    struct _fs_t *fs; // null => slot is unused
+    uint32_t ino;
+    uint32_t index; // page index in file
+    uint32_t paddr;
+    short next; // next slot in the same hash bucket, -1 if none
+    uint8_t referenced; // for clock replacement
+    uint8_t exec; // mapped as program text, dropped instead of updated when the file is written
+}pcache_page_t;
+
+void pcache_init(void);
+uint32_t pcache_get(file_t *file, uint32_t index);
+uint32_t pcache_get_exec(file_t *file, uint32_t index);
+void pcache_write(file_t *file, uint32_t offset, const char *buf, int size);
+void pcache_invalidate(struct _fs_t *fs, uint32_t ino);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef PIPE_H
+#define PIPE_H
+
+#include "comm/types.h"
+#include "tools/buffer.h"
+#include "tools/list.h"
+
+#define PIPE_NUM 32
+#define PIPE_BUF_SIZE 4096 // one page
+
+// an anonymous pipe, the two ends are file_t with file->dev_id as index of the pipe
+// readers and writers count the opened ends, not the fds (fork and dup share a file_t)
+typedef struct _pipe_t {
+    int used;
+    int readers;
+    int writers;
+    fifo_t fifo;
+    list_t read_wait; // tasks waiting for data
+    list_t write_wait; // tasks waiting for room
+}pipe_t;
+
+void pipe_init(void);
+int sys_pipe(int *fds);
+
+#endif
@@ -11,6 +11,8 @@ typedef struct {
 void sem_init(sem_t *sem, int count);
 void sem_wait(sem_t *sem);
 void sem_notify(sem_t *sem);
+int sem_wait_n(sem_t *sem, int n);
+void sem_notify_n(sem_t *sem, int n);
 
 #endif
 
@@ -13,6 +13,7 @@ int bitmap_get_bit(bitmap_t *bitmap, int index);
 void bitmap_set_bit(bitmap_t *bitmap, int index, int count, int value);
 int bitmap_is_set(bitmap_t *bitmap, int index);
 int bitmap_alloc_nbits(bitmap_t *bitmap, int bit, int count);
+int bitmap_find_bit(bitmap_t *bitmap, int bit, int start);
 int bitmap_byte_count (int bit_count);
 
 #endif
\ No newline at end of file
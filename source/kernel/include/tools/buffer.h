@@ -15,6 +15,8 @@ int fifo_put(fifo_t *fifo, char c);
 int fifo_put_sector_size(fifo_t *fifo, char *c);
 int fifo_get(fifo_t *fifo, char *c);
 int fifo_get_sector_size(fifo_t *fifo, char **c);
+int fifo_put_bulk(fifo_t *fifo, const char *buf, int size);
+int fifo_get_bulk(fifo_t *fifo, char *buf, int size);
 void fifo_init(fifo_t *fifo, char *buf, int size);
 void fifo_reset(fifo_t *fifo);
 
@@ -23,6 +23,8 @@ int kernel_strlen(const char *s);
 void kernel_memcpy(void *dest, const void *src, int n);
 void kernel_memset(void *dest, uint8_t v, int n);
 int kernel_memcmp(const void *d1, const void *d2, int n);
+void kernel_page_copy(void *dest, const void *src);
+void kernel_page_zero(void *dest);
 
 void kernel_vsprintf(char *buf, const char *fmt, va_list args);
 void kernel_sprintf(char *buf, const char *fmt, ...);
@@ -1,7 +1,33 @@
 #ifndef LOG_H
 #define LOG_H
 
+#include <stdarg.h>
+#include "comm/types.h"
+
+// levels of log records, log_printf uses LOG_INFO
+#define LOG_ERR 0
+#define LOG_WARN 1
+#define LOG_INFO 2
+#define LOG_DEBUG 3
+
+#define LOG_RECORD_NUM 128 // records kept in the ring, must be a power of 2
+#define LOG_TEXT_SIZE 112
+#define LOG_FLUSH_MS 20 // how often the log task writes out new records
+#define LOG_SEQ_INVALID 0xFFFFFFFF
+
+typedef struct _log_record_t {
+    uint32_t seq; // LOG_SEQ_INVALID while the record is being written
+    uint32_t tick; // time of log_printf
+    int level;
+    char text[LOG_TEXT_SIZE];
+}log_record_t;
+
 void log_init(void);
+void log_task_init(void);
+void log_flush(void);
 void log_printf(const char *fmt, ...);
+void log_printk(int level, const char *fmt, ...);
+void log_vprintk(int level, const char *fmt, va_list args);
+int sys_dmesg(char *buf, int size);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,50 @@
+#ifndef PROF_H
+#define PROF_H
+
+#include "comm/types.h"
+#include "cpu/cpu.h"
+
+// commands of sys_prof
+#define PROF_CMD_START 0 // arg: samples per timer tick (1 ~ PROF_RATE_MAX)
+#define PROF_CMD_STOP 1
+#define PROF_CMD_READ 2 // copy a prof_header_t, the task table and the samples to buf
+
+#define PROF_BUF_PAGES 16 // allocated by the first PROF_CMD_START
+#define PROF_RATE_MAX 10 // the pit runs at most 10 times faster than the os tick
+#define PROF_TASK_NUM 32 // different (pid, name) seen while sampling
+#define PROF_TASK_NONE 0xFF // the task table was full
+#define PROF_MAGIC 0x464F5250 // "PROF"
+#define PROF_VERSION 2
+
+// 12 bytes, little endian
+typedef struct _prof_sample_t {
+    uint32_t eip;
+    uint32_t pid;
+    uint8_t cpl; // 0: kernel, 3: user
+    uint8_t task; // index in the task table, tells which program eip belongs to
+    uint16_t reserved; // always 0
+}prof_sample_t;
+
+// tasks change their name in execve, so the same pid may be in the table more than once
+typedef struct _prof_task_t {
+    uint32_t pid;
+    char name[32];
+}prof_task_t;
+
+// start of the dump, followed by task_count prof_task_t and count prof_sample_t
+typedef struct _prof_header_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sample_size;
+    uint32_t task_count;
+    uint32_t count;
+    uint32_t lost; // samples dropped because the buffer was full
+    uint32_t hz; // samples per second
+}prof_header_t;
+
+extern int prof_enabled;
+
+void prof_sample(exception_frame_t *frame);
+int sys_prof(int cmd, int arg, char *buf, int size);
+
+#endif
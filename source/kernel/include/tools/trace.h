@@ -0,0 +1,66 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "comm/types.h"
+
+// commands of sys_trace
+#define TRACE_CMD_START 0 // clear the buffer and start recording
+#define TRACE_CMD_STOP 1
+#define TRACE_CMD_READ 2 // copy a trace_header_t and the records to buf
+
+#define TRACE_BUF_PAGES 16 // allocated by the first TRACE_CMD_START
+#define TRACE_MAGIC 0x45435254 // "TRCE"
+#define TRACE_VERSION 2
+
+// events, tools/trace2json.py has the same list
+#define TRACE_SWITCH 1 // arg0: pid switched to
+#define TRACE_SYSCALL 2 // arg0: syscall id, arg1: return value (end)
+#define TRACE_DISK_READ 3 // arg0: sector, arg1: count (begin) or return value (end)
+#define TRACE_DISK_WRITE 4
+#define TRACE_PAGE_FAULT 5 // arg0: address, arg1: error code (begin) or result (end)
+#define TRACE_MUTEX_WAIT 6 // arg0: mutex, arg1: pid of the owner
+
+#define TRACE_INSTANT 0
+#define TRACE_BEGIN 1
+#define TRACE_END 2
+
+// 24 bytes, little endian, every field naturally aligned
+typedef struct _trace_record_t {
+    uint64_t tsc;
+    uint8_t event;
+    uint8_t phase;
+    uint16_t reserved; // always 0
+    uint32_t pid; // task running when the record was written, 0 before the first task
+    uint32_t arg0;
+    uint32_t arg1;
+}trace_record_t;
+
+// start of the dump, followed by count records (oldest first)
+// the tsc and tick pairs let the reader turn tsc into time
+typedef struct _trace_header_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t count;
+    uint32_t lost; // records overwritten since the start
+    uint32_t tick_ms;
+    uint32_t start_tick;
+    uint32_t end_tick;
+    uint64_t start_tsc;
+    uint64_t end_tsc;
+}trace_header_t;
+
+extern int trace_enabled;
+
+void trace_write(int event, int phase, uint32_t arg0, uint32_t arg1);
+
+// tracepoints cost a load and a branch while tracing is off
+static inline void trace_event(int event, int phase, uint32_t arg0, uint32_t arg1) {
+    if (trace_enabled) {
+        trace_write(event, phase, arg0, arg1);
+    }
+}
+
+int sys_trace(int cmd, char *buf, int size);
+
+#endif
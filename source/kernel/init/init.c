@@ -31,6 +31,7 @@ void kernel_init(boot_info_t *boot_info) {
     fs_init();
     time_init();
     task_manager_init();
+    log_task_init(); // log records are kept in memory until this task runs
 
     // no longer used, it is now in tty_open
     // kbd_init(); // should be after cpu_init cuz it uses irq_protection
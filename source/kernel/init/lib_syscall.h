@@ -44,6 +44,7 @@ struct dirent {
 
 typedef struct _DIR {
     int index;
+    int cluster; // first cluster of the directory, 0 for root
     struct dirent dirent;
 }DIR;
 
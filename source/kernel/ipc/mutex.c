@@ -1,5 +1,6 @@
 #include "ipc/mutex.h"
 #include "core/task.h"
+#include "tools/trace.h"
 
 void mutex_init(mutex_t *mutex) {
     mutex->locked_count = 0;
@@ -16,9 +17,11 @@ void mutex_lock(mutex_t *mutex) {
             // at first, i wrote sth like this and actually the right hand side
             // does not refer to the "outer" curr, it refers to the inner curr itself (shadowing)
             // task_t *curr = curr;
+            trace_event(TRACE_MUTEX_WAIT, TRACE_BEGIN, (uint32_t)mutex, mutex->owner->pid);
             task_set_unready(curr);
             list_insert_last(&mutex->wait_list, &curr->run_node); // change from wait_node to run_node
             task_dispatch();
+            trace_event(TRACE_MUTEX_WAIT, TRACE_END, (uint32_t)mutex, 0);
         } else {
             mutex->locked_count++;
         }
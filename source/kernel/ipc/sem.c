@@ -38,4 +38,45 @@ void sem_notify(sem_t *sem) {
     }
 
     irq_leave_protection(state);
-}
\ No newline at end of file
+}
+
+// take up to n counts at once (e.g. n free slots of a buffer)
+// blocks only when there is none, returns the number taken (at least 1)
+int sem_wait_n(sem_t *sem, int n) {
+    irq_state_t state = irq_enter_protection();
+
+    int taken = 1;
+    if (sem->count > 0) {
+        taken = (sem->count < n) ? sem->count : n;
+        sem->count -= taken;
+    } else {
+        // sem_notify hands one count to the waiting task
+        task_t *curr = task_current();
+        task_set_unready(curr);
+        list_insert_last(&sem->wait_list, &curr->run_node);
+        task_dispatch();
+    }
+
+    irq_leave_protection(state);
+    return taken;
+}
+
+// same as calling sem_notify n times, but dispatches only once
+void sem_notify_n(sem_t *sem, int n) {
+    irq_state_t state = irq_enter_protection();
+
+    int woken = 0;
+    while (n > 0 && list_count(&sem->wait_list) > 0) {
+        list_node_t *node = list_first(&sem->wait_list);
+        list_remove_first(&sem->wait_list);
+        task_set_ready(parent_pointer(task_t, run_node, node));
+        woken = 1;
+        n--;
+    }
+    sem->count += n;
+    if (woken) {
+        task_dispatch();
+    }
+
+    irq_leave_protection(state);
+}
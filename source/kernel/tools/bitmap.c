@@ -70,5 +70,25 @@ int bitmap_alloc_nbits(bitmap_t *bitmap, int bit, int count) {
     return -1;
 }
 
+// find the first bit that equals to "bit", starting from index "start"
+// bytes that can't contain such a bit are skipped as a whole
+int bitmap_find_bit(bitmap_t *bitmap, int bit, int start) {
+    uint8_t skip = bit ? 0x00 : 0xFF;
+    int index = start < 0 ? 0 : start;
+    while (index < bitmap->bit_count) {
+        if ((index % 8) == 0 && bitmap->start[index / 8] == skip) {
+            index += 8;
+            continue;
+        }
+
+        if (!bitmap_is_set(bitmap, index) == !bit) {
+            return index;
+        }
+        index++;
+    }
+
+    return -1;
+}
+
 
 
@@ -79,6 +79,50 @@ int fifo_get(fifo_t *fifo, char *c) {
     return 0;
 }
 
+// copy as many bytes as there is room for, at most two memcpy (before and after wrapping)
+// returns the number of bytes put
+int fifo_put_bulk(fifo_t *fifo, const char *buf, int size) {
+    irq_state_t state = irq_enter_protection();
+
+    int free = fifo->size - fifo->count;
+    if (size > free) {
+        size = free;
+    }
+
+    int first = fifo->size - fifo->write;
+    if (first > size) {
+        first = size;
+    }
+    kernel_memcpy(fifo->buf + fifo->write, buf, first);
+    kernel_memcpy(fifo->buf, buf + first, size - first);
+    fifo->write = (fifo->write + size) % fifo->size;
+    fifo->count += size;
+
+    irq_leave_protection(state);
+    return size;
+}
+
+// returns the number of bytes got, 0 if the fifo is empty
+int fifo_get_bulk(fifo_t *fifo, char *buf, int size) {
+    irq_state_t state = irq_enter_protection();
+
+    if (size > fifo->count) {
+        size = fifo->count;
+    }
+
+    int first = fifo->size - fifo->read;
+    if (first > size) {
+        first = size;
+    }
+    kernel_memcpy(buf, fifo->buf + fifo->read, first);
+    kernel_memcpy(buf + first, fifo->buf, size - first);
+    fifo->read = (fifo->read + size) % fifo->size;
+    fifo->count -= size;
+
+    irq_leave_protection(state);
+    return size;
+}
+
 void fifo_init(fifo_t *fifo, char *buf, int size) {
     fifo->buf = buf;
     fifo->count = 0;
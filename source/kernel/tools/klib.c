@@ -1,6 +1,7 @@
 #include "tools/klib.h"
 #include "tools/log.h"
 #include "comm/cpu_instr.h"
+#include "core/memory.h"
 
 // useful link about null pointers: https://stackoverflow.com/questions/76219480/is-every-null-pointer-constant-a-null-pointer
 // Conversion of a null pointer to another pointer type yields a null pointer of that type. Any two null pointers shall compare equal.
@@ -114,44 +115,83 @@ int kernel_strlen(const char *s) {
     return count;
 } 
 
+// copies forward (the same as the byte loop it replaces), so moving data
+// to a lower address in the same buffer (e.g. scrolling the screen) still works
+// small copies are done byte by byte, larger ones align the destination
+// and move 4 bytes at a time with rep movsd
 void kernel_memcpy(void *dest, const void *src, int n) {
-    if (!dest || !src || !n) {
+    if (!dest || !src || n <= 0) {
         return;
     }
 
     uint8_t *d = dest;
     const uint8_t *s = src;
-
-    for (int i = 0; i < n; i++) {
-        *d = *s;
-        d++;
-        s++;
+    if (n >= 16) {
+        int head = (4 - ((uint32_t)d & 3)) & 3;
+        int dwords = (n - head) >> 2;
+        n = (n - head) & 3;
+        __asm__ __volatile__("cld\n\trep movsb"
+                : "+D"(d), "+S"(s), "+c"(head) :: "memory");
+        __asm__ __volatile__("rep movsl"
+                : "+D"(d), "+S"(s), "+c"(dwords) :: "memory");
     }
-
-    return;
+    __asm__ __volatile__("cld\n\trep movsb"
+            : "+D"(d), "+S"(s), "+c"(n) :: "memory");
 }
 
 void kernel_memset(void *dest, uint8_t v, int n) {
-    if (!dest || !n) {
+    if (!dest || n <= 0) {
         return;
     }
 
     uint8_t *d = dest;
-    for (int i = 0; i < n; i++) {
-        *d = v;
-        d++;
+    if (n >= 16) {
+        int head = (4 - ((uint32_t)d & 3)) & 3;
+        int dwords = (n - head) >> 2;
+        n = (n - head) & 3;
+        uint32_t v4 = v * 0x01010101;
+        __asm__ __volatile__("cld\n\trep stosb"
+                : "+D"(d), "+c"(head) : "a"(v4) : "memory");
+        __asm__ __volatile__("rep stosl"
+                : "+D"(d), "+c"(dwords) : "a"(v4) : "memory");
     }
+    __asm__ __volatile__("cld\n\trep stosb"
+            : "+D"(d), "+c"(n) : "a"(v) : "memory");
+}
+
+// whole pages, both addresses are page aligned
+void kernel_page_copy(void *dest, const void *src) {
+    int dwords = MEM_PAGE_SIZE / 4;
+    __asm__ __volatile__("cld\n\trep movsl"
+            : "+D"(dest), "+S"(src), "+c"(dwords) :: "memory");
 }
 
+void kernel_page_zero(void *dest) {
+    int dwords = MEM_PAGE_SIZE / 4;
+    __asm__ __volatile__("cld\n\trep stosl"
+            : "+D"(dest), "+c"(dwords) : "a"(0) : "memory");
+}
+
+// reads 4 bytes through any pointer without breaking strict aliasing
+typedef uint32_t __attribute__((__may_alias__)) uint32_alias_t;
+
 // doesn't check null pointer
 int kernel_memcmp(const void *d1, const void *d2, int n) {
-    if (n == 0) {
+    if (n <= 0) {
         return 0;
     }
 
     const uint8_t *b1 = d1;
     const uint8_t *b2 = d2;
 
+    // skip the equal part 4 bytes at a time, the bytes of the first
+    // different word are compared one by one below
+    while (n >= 4 && *(const uint32_alias_t*)b1 == *(const uint32_alias_t*)b2) {
+        b1 += 4;
+        b2 += 4;
+        n -= 4;
+    }
+
     for (int i = 0; i < n; i++, b1++, b2++) {
         if (*b1 < *b2) {
             return -1;
@@ -265,6 +305,7 @@ void kernel_itoa(char *buf, int num, int base) {
 void panic(const char *file, int line, const char *func, const char *cond) {
     log_printf("Assert Failed! %s", cond);
     log_printf("file: %s\nline: %d\nfunc: %s\n", file, line, func);
+    log_flush(); // the log task won't run anymore
     for (;;) {
         hlt();
     }
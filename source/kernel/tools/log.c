@@ -6,70 +6,197 @@
 #include "ipc/mutex.h"
 #include "dev/console.h"
 #include "dev/dev.h"
+#include "dev/time.h"
+#include "core/task.h"
+#include "core/vma.h"
+#include "os_cfg.h"
 
-#define LOG_USE_COM 0
-#define COM1_PORT 0x3F8
+#define LOG_USE_COM 0 // also write the log to ttyS0
 
-static mutex_t mutex;
-static int log_dev_id;
+// log_printf only puts a record into the ring, it never sleeps or waits for the console
+// so it can be used anywhere (interrupt handlers, with locks held...)
+// the log task writes the records out later
+//
+// a writer takes a sequence number with an atomic add, the record at seq % LOG_RECORD_NUM is its own,
+// and rec->seq is set last to publish it. no lock is needed, writers only race for the number.
+// when the ring is full the oldest records are overwritten
+static log_record_t log_ring[LOG_RECORD_NUM];
+static volatile uint32_t log_next_seq; // sequence number of the next record
+static uint32_t log_flush_seq; // next record to write out, only used by log_flush
 
-// initialization for RS-232
+static mutex_t mutex; // serializes log_flush, not log_printf
+static int log_dev_id = -1;
+#if LOG_USE_COM
+static int log_com_id = -1;
+#endif
+
+static task_t log_task;
+static uint32_t log_task_stack[1024];
+
+// the ring needs no hardware, the devices are opened by the first log_flush
 void log_init(void) {
     mutex_init(&mutex);
-    log_dev_id = dev_open(DEV_TTY, 0, (void*)0);
+    for (int i = 0; i < LOG_RECORD_NUM; i++) {
+        log_ring[i].seq = LOG_SEQ_INVALID;
+    }
+}
 
-#if LOG_USE_COM
-    outb(COM1_PORT + 1, 0x00);
-    outb(COM1_PORT + 3, 0x80);   
-    outb(COM1_PORT + 0, 0x03);
-    outb(COM1_PORT + 1, 0x00);
-    outb(COM1_PORT + 3, 0x03);
-    outb(COM1_PORT + 2, 0xC7);
-    outb(COM1_PORT + 4, 0x0F);
-#endif
+void log_vprintk(int level, const char *fmt, va_list args) {
+    char str_buf[128];
+    kernel_memset(str_buf, '\0', sizeof(str_buf)); // important!
+    kernel_vsprintf(str_buf, fmt, args);
 
+    // xadd is a single instruction, an interrupt can't split it
+    uint32_t seq = 1;
+    __asm__ __volatile__("lock xaddl %[seq], %[next]"
+            : [seq]"+r"(seq), [next]"+m"(log_next_seq) :: "memory");
+    log_record_t *rec = log_ring + seq % LOG_RECORD_NUM;
+    rec->seq = LOG_SEQ_INVALID; // the slot is being written
+    __asm__ __volatile__("" ::: "memory");
+
+    rec->tick = time_get_ticks();
+    rec->level = level;
+    kernel_strncpy(rec->text, str_buf, LOG_TEXT_SIZE - 1);
+    rec->text[LOG_TEXT_SIZE - 1] = '\0';
+
+    __asm__ __volatile__("" ::: "memory");
+    rec->seq = seq;
 }
 
-// qemu is able to display the data going through RS-232,
+void log_printk(int level, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    log_vprintk(level, fmt, args);
+    va_end(args);
+}
+
+// qemu is able to display the data going through RS-232 (ttyS0, see LOG_USE_COM),
 // and we are using it to display the log
 // log_printf "automatically" adds \n at the end
 void log_printf(const char *fmt, ...) {
-    char str_buf[128];
-    kernel_memset(str_buf, '\0', sizeof(str_buf)); // important!
-
     va_list args;
     va_start(args, fmt); // the second argument is to pass "the last parameter" that is not "variable arguments"
-    kernel_vsprintf(str_buf, fmt, args);
+    log_vprintk(LOG_INFO, fmt, args);
     va_end(args);
+}
 
-    // irq_state_t state = irq_enter_protection();
-    mutex_lock(&mutex);
+// copy the record with sequence number seq, returns -1 if it is not written yet
+// or it has been overwritten in the middle of copying
+static int log_read_record(uint32_t seq, log_record_t *out) {
+    log_record_t *rec = log_ring + seq % LOG_RECORD_NUM;
+    if (rec->seq != seq) {
+        return -1;
+    }
+    kernel_memcpy(out, rec, sizeof(log_record_t));
+    __asm__ __volatile__("" ::: "memory");
+    return (rec->seq == seq) ? 0 : -1;
+}
 
+static const char *level_name(int level) {
+    static const char *names[] = {"err", "warn", "info", "debug"};
+    if (level < 0 || level > LOG_DEBUG) {
+        return "?";
+    }
+    return names[level];
+}
+
+// "[ms] level: text", returns the length
+static int log_format_record(log_record_t *rec, char *buf) {
+    kernel_sprintf(buf, "[%d] %s: %s\n", rec->tick * OS_TICK_MS, level_name(rec->level), rec->text);
+    return kernel_strlen(buf);
+}
+
+static void log_output(const char *str, int len) {
 #if LOG_USE_COM
-    char *p = str_buf;
-    while (*p) {
-        // check if it is busy or not (check if the sixth bit is zero)
-        while (inb(COM1_PORT + 5) & (1 << 6) == 0);
-        outb(COM1_PORT, *p);
-        p++;
+    // the serial driver only queues the text, the uart interrupt sends it
+    if (log_com_id >= 0) {
+        dev_write(log_com_id, 0, (char*)str, len);
     }
-    
-    outb(COM1_PORT, '\r');
-    outb(COM1_PORT, '\n');
 #endif
 
-    // console_write(0, str_buf, kernel_strlen(str_buf));
     // we don't need '\r' because out code make '\n' do both things
-    // console_write(0, "\n", 1);
-    dev_write(log_dev_id, 0, "log:", 4);
-    dev_write(log_dev_id, 0, str_buf, kernel_strlen(str_buf));
-    char c = '\n';
-    dev_write(log_dev_id, 0, &c, 1);
+    dev_write(log_dev_id, 0, (char*)str, len);
+}
+
+// write the new records out to the console (and serial port)
+// records overwritten before they are written are skipped
+void log_flush(void) {
+    mutex_lock(&mutex);
+    if (log_dev_id < 0) {
+        log_dev_id = dev_open(DEV_TTY, 0, (void*)0);
+    }
+#if LOG_USE_COM
+    if (log_com_id < 0) {
+        log_com_id = dev_open(DEV_SERIAL, 0, (void*)0);
+    }
+#endif
+
+    uint32_t next = log_next_seq;
+    if (next - log_flush_seq > LOG_RECORD_NUM) {
+        log_flush_seq = next - LOG_RECORD_NUM;
+    }
+
+    while (log_flush_seq != next) {
+        log_record_t rec;
+        if (log_read_record(log_flush_seq, &rec) < 0) {
+            if (next - log_flush_seq > LOG_RECORD_NUM) {
+                log_flush_seq++; // overwritten, skip it
+                continue;
+            }
+            break; // still being written, next time
+        }
 
-    // irq_leave_protection(state);
+        char buf[LOG_TEXT_SIZE + 32];
+        int len = log_format_record(&rec, buf);
+        log_output(buf, len);
+        log_flush_seq++;
+    }
     mutex_unlock(&mutex);
 }
 
+// runs at the lowest pace of all tasks, it only wakes up every LOG_FLUSH_MS
+static void log_task_entry(void) {
+    for (;;) {
+        log_flush();
+        sys_msleep(LOG_FLUSH_MS);
+    }
+}
+
+// records before this are kept in the ring, and written by the first flush
+void log_task_init(void) {
+    task_init(&log_task, "log task", TASK_FLAG_SYSTEM, (uint32_t)log_task_entry, (uint32_t)&log_task_stack[1024]);
+    task_start(&log_task);
+}
+
+// copy the records in the ring as text (oldest first) to buf, returns the bytes copied
+// the ring is not changed, so dmesg can be run any times
+int sys_dmesg(char *buf, int size) {
+    if (!buf || size <= 0) {
+        return -1;
+    }
+
+    vma_prefault((uint32_t)buf, size, 1);
+    uint32_t next = log_next_seq;
+    uint32_t seq = (next > LOG_RECORD_NUM) ? next - LOG_RECORD_NUM : 0;
+    int total = 0;
+    for (; seq != next; seq++) {
+        log_record_t rec;
+        if (log_read_record(seq, &rec) < 0) {
+            continue;
+        }
+
+        char line[LOG_TEXT_SIZE + 32];
+        int len = log_format_record(&rec, line);
+        if (total + len > size) {
+            break;
+        }
+        kernel_memcpy(buf + total, line, len);
+        total += len;
+    }
+
+    return total;
+}
+
 
 // const char *a => can change the object pointing to, but cannot modify the value
-// char* const a => cannot change the object pointing to, but can modify the value
\ No newline at end of file
+// char* const a => cannot change the object pointing to, but can modify the value
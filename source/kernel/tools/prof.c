@@ -0,0 +1,149 @@
+#include "tools/prof.h"
+#include "tools/klib.h"
+#include "tools/log.h"
+#include "core/task.h"
+#include "core/memory.h"
+#include "core/vma.h"
+#include "dev/time.h"
+#include "os_cfg.h"
+
+// sampling profiler, the timer interrupt calls prof_sample with the frame it interrupted
+// so every sample is the eip (and pid, privilege level) running at that moment
+// the pit can be run faster than the os tick while profiling, see time_set_rate
+// samples are kept until the buffer is full and then dropped, tools/prof.py makes a flat profile
+
+int prof_enabled;
+
+static prof_sample_t *prof_buf;
+static int prof_size; // samples in prof_buf
+static int prof_count;
+static uint32_t prof_lost;
+static int prof_rate; // samples per os tick
+static prof_task_t prof_tasks[PROF_TASK_NUM];
+static int prof_task_count;
+
+// the same task is looked up again and again, so the last one is checked first
+static int prof_task_idx(task_t *task) {
+    static int last;
+    if (last < prof_task_count && prof_tasks[last].pid == task->pid &&
+        kernel_strncmp(prof_tasks[last].name, task->name, TASK_NAME_SIZE) == 0) {
+        return last;
+    }
+
+    for (int i = 0; i < prof_task_count; i++) {
+        prof_task_t *t = prof_tasks + i;
+        if (t->pid == task->pid && kernel_strncmp(t->name, task->name, TASK_NAME_SIZE) == 0) {
+            last = i;
+            return i;
+        }
+    }
+
+    if (prof_task_count >= PROF_TASK_NUM) {
+        return PROF_TASK_NONE;
+    }
+
+    prof_task_t *t = prof_tasks + prof_task_count;
+    t->pid = task->pid;
+    kernel_strncpy(t->name, task->name, sizeof(t->name));
+    last = prof_task_count++;
+    return last;
+}
+
+// called in the timer interrupt, so interrupts are already off
+void prof_sample(exception_frame_t *frame) {
+    if (prof_count >= prof_size) {
+        prof_lost++;
+        return;
+    }
+
+    task_t *curr = task_current();
+    prof_sample_t *sample = prof_buf + prof_count++;
+    sample->eip = frame->eip;
+    sample->cpl = frame->cs & 0x3;
+    sample->pid = curr ? curr->pid : 0;
+    sample->task = curr ? prof_task_idx(curr) : PROF_TASK_NONE;
+    sample->reserved = 0;
+}
+
+static int prof_start(int rate) {
+    if (rate < 1 || rate > PROF_RATE_MAX) {
+        log_printf("profiler rate %d is out of range", rate);
+        return -1;
+    }
+
+    if (!prof_buf) {
+        prof_buf = (prof_sample_t*)mem_alloc_page(PROF_BUF_PAGES);
+        if (!prof_buf) {
+            log_printf("no memory for profiler buffer");
+            return -1;
+        }
+        prof_size = PROF_BUF_PAGES * MEM_PAGE_SIZE / sizeof(prof_sample_t);
+    }
+
+    irq_state_t state = irq_enter_protection();
+    prof_count = 0;
+    prof_lost = 0;
+    prof_task_count = 0;
+    prof_rate = rate;
+    prof_enabled = 1;
+    time_set_rate(rate);
+    irq_leave_protection(state);
+    return 0;
+}
+
+static void prof_stop(void) {
+    irq_state_t state = irq_enter_protection();
+    if (prof_enabled) {
+        prof_enabled = 0;
+        time_set_rate(1);
+    }
+    irq_leave_protection(state);
+}
+
+// copy the header, the task table and as many samples as fit
+static int prof_read(char *buf, int size) {
+    int fixed = sizeof(prof_header_t) + sizeof(prof_tasks);
+    if (!buf || size < fixed) {
+        return -1;
+    }
+
+    vma_prefault((uint32_t)buf, size, 1);
+
+    irq_state_t state = irq_enter_protection();
+    int count = (size - fixed) / sizeof(prof_sample_t);
+    if (count > prof_count) {
+        count = prof_count;
+    }
+
+    prof_header_t *header = (prof_header_t*)buf;
+    header->magic = PROF_MAGIC;
+    header->version = PROF_VERSION;
+    header->sample_size = sizeof(prof_sample_t);
+    header->task_count = prof_task_count;
+    header->count = count;
+    header->lost = prof_lost + (prof_count - count);
+    header->hz = 1000 / OS_TICK_MS * prof_rate;
+
+    char *dest = buf + sizeof(prof_header_t);
+    kernel_memcpy(dest, prof_tasks, prof_task_count * sizeof(prof_task_t));
+    dest += prof_task_count * sizeof(prof_task_t);
+    kernel_memcpy(dest, prof_buf, count * sizeof(prof_sample_t));
+    irq_leave_protection(state);
+
+    return dest + count * sizeof(prof_sample_t) - buf;
+}
+
+int sys_prof(int cmd, int arg, char *buf, int size) {
+    switch (cmd) {
+        case PROF_CMD_START:
+            return prof_start(arg);
+        case PROF_CMD_STOP:
+            prof_stop();
+            return 0;
+        case PROF_CMD_READ:
+            return prof_read(buf, size);
+        default:
+            log_printf("unknown profiler command %d", cmd);
+            return -1;
+    }
+}
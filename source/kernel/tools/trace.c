@@ -0,0 +1,134 @@
+#include "tools/trace.h"
+#include "tools/klib.h"
+#include "tools/log.h"
+#include "comm/cpu_instr.h"
+#include "cpu/cpu.h"
+#include "core/task.h"
+#include "core/memory.h"
+#include "core/vma.h"
+#include "dev/time.h"
+#include "os_cfg.h"
+
+// binary records with tsc timestamps, written by the tracepoints in a ring
+// that overwrites the oldest records when full
+// the kernel runs on one cpu, so there is one ring and writers only have to keep interrupts off
+// while they take a slot. tools/trace2json.py turns a dump into chrome trace json
+
+int trace_enabled;
+
+static trace_record_t *trace_buf;
+static int trace_size; // records in trace_buf
+static int trace_head; // next record to write
+static int trace_count;
+static uint32_t trace_lost;
+static uint32_t trace_start_tick;
+static uint64_t trace_start_tsc;
+
+void trace_write(int event, int phase, uint32_t arg0, uint32_t arg1) {
+    irq_state_t state = irq_enter_protection();
+    if (!trace_enabled) {
+        irq_leave_protection(state);
+        return;
+    }
+
+    trace_record_t *rec = trace_buf + trace_head;
+    if (++trace_head >= trace_size) {
+        trace_head = 0;
+    }
+    if (trace_count < trace_size) {
+        trace_count++;
+    } else {
+        trace_lost++;
+    }
+
+    task_t *curr = task_current();
+    rec->tsc = rdtsc();
+    rec->event = event;
+    rec->phase = phase;
+    rec->reserved = 0;
+    rec->pid = curr ? curr->pid : 0;
+    rec->arg0 = arg0;
+    rec->arg1 = arg1;
+    irq_leave_protection(state);
+}
+
+static int trace_start(void) {
+    if (!trace_buf) {
+        trace_buf = (trace_record_t*)mem_alloc_page(TRACE_BUF_PAGES);
+        if (!trace_buf) {
+            log_printf("no memory for trace buffer");
+            return -1;
+        }
+        trace_size = TRACE_BUF_PAGES * MEM_PAGE_SIZE / sizeof(trace_record_t);
+    }
+
+    irq_state_t state = irq_enter_protection();
+    trace_head = 0;
+    trace_count = 0;
+    trace_lost = 0;
+    trace_start_tick = time_get_ticks();
+    trace_start_tsc = rdtsc();
+    trace_enabled = 1;
+    irq_leave_protection(state);
+    return 0;
+}
+
+// copy the header and as many records as fit, oldest first
+// the buffer is left as it is, so it can be read again
+static int trace_read(char *buf, int size) {
+    if (!buf || size < (int)sizeof(trace_header_t)) {
+        return -1;
+    }
+
+    // page faults would be traced into the buffer we are copying
+    vma_prefault((uint32_t)buf, size, 1);
+
+    irq_state_t state = irq_enter_protection();
+    trace_header_t *header = (trace_header_t*)buf;
+    int count = (size - sizeof(trace_header_t)) / sizeof(trace_record_t);
+    if (count > trace_count) {
+        count = trace_count;
+    }
+
+    header->magic = TRACE_MAGIC;
+    header->version = TRACE_VERSION;
+    header->record_size = sizeof(trace_record_t);
+    header->count = count;
+    header->lost = trace_lost + (trace_count - count);
+    header->tick_ms = OS_TICK_MS;
+    header->start_tick = trace_start_tick;
+    header->start_tsc = trace_start_tsc;
+    header->end_tick = time_get_ticks();
+    header->end_tsc = rdtsc();
+
+    // skip the oldest records that don't fit
+    int idx = trace_head - count;
+    if (idx < 0) {
+        idx += trace_size;
+    }
+    char *dest = buf + sizeof(trace_header_t);
+    int first = trace_size - idx;
+    if (first > count) {
+        first = count;
+    }
+    kernel_memcpy(dest, trace_buf + idx, first * sizeof(trace_record_t));
+    kernel_memcpy(dest + first * sizeof(trace_record_t), trace_buf, (count - first) * sizeof(trace_record_t));
+    irq_leave_protection(state);
+
+    return sizeof(trace_header_t) + count * sizeof(trace_record_t);
+}
+
+int sys_trace(int cmd, char *buf, int size) {
+    switch (cmd) {
+        case TRACE_CMD_START:
+            return trace_start();
+        case TRACE_CMD_STOP:
+            trace_enabled = 0;
+            return 0;
+        case TRACE_CMD_READ:
+            return trace_read(buf, size);
+        default:
+            log_printf("unknown trace command %d", cmd);
+            return -1;
+    }
+}
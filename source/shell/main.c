@@ -7,6 +7,8 @@
 #include <sys/file.h>
 #include "fs/file.h"
 #include "dev/tty.h"
+#include "tools/trace.h"
+#include "tools/prof.h"
 
 static cli_t cli; // each process has a unique one, not shared (fork doesn't share global var)
 static const char *prompt = "sh >> ";
@@ -72,45 +74,96 @@ static int do_echo(int argc, char **argv) {
     return 0;
 }
 
+// 64 bit division without libgcc, both sides are shifted until a fits in 32 bits
+// precise enough for turning cycles into ms
+static uint32_t div_u64(uint64_t a, uint64_t b) {
+    if (b == 0 || b > a) {
+        return 0;
+    }
+    while (a >> 32) {
+        a >>= 1;
+        b >>= 1;
+    }
+    return (uint32_t)a / (uint32_t)b;
+}
+
+static uint32_t clock_cycles_per_ms(task_clock_t *clock) {
+    uint32_t per_ms = div_u64(clock->tsc, clock->ticks * clock->tick_ms);
+    return per_ms ? per_ms : 1;
+}
+
+static uint32_t clock_elapsed_us(task_clock_t *start, task_clock_t *end) {
+    return div_u64((end->tsc - start->tsc) * 1000, clock_cycles_per_ms(end));
+}
+
 static int do_cp(int argc, char **argv) {
-    if (argc < 3) {
+    int from = -1, to = -1;
+    int timed = 0;
+    char ch = '\0';
+    while ((ch = getopt(argc, argv, "t")) != -1) {
+        switch (ch) {
+            case 't':
+                timed = 1;
+                break;
+            default:
+                optind = 1;
+                return -1;
+        }
+    }
+    if (argc - optind < 2) {
         fprintf(stderr, "invalid arguments, num of arg=%d\n", argc);
         goto cp_failed;
     }
+    char *src = argv[optind], *dest = argv[optind + 1];
 
-    FILE *from = (FILE*)0, *to = (FILE*)0;
-    from = fopen(argv[1], "rb"); // read mode, binary mode
-    if (!from) {
+    task_clock_t start, end;
+    get_clock(&start);
+
+    from = open(src, O_RDONLY);
+    if (from < 0) {
         fprintf(stderr, "open src file failed\n");
         goto cp_failed;
     }
 
-    to = fopen(argv[2], "wb");
-    if (!to) {
+    to = open(dest, O_WRONLY | O_CREAT | O_TRUNC);
+    if (to < 0) {
         fprintf(stderr, "open dest file failed\n");
         goto cp_failed;
     }
 
-    char *buf = malloc(sizeof(char)*255);
+    // the data is copied inside the kernel, it never comes to this process
     int size;
-    // these functions use buffer to store to 1024
-    // after this they call system calls
-    while ((size = fread(buf, sizeof(char), 255, from)) > 0) {
-        fwrite(buf, sizeof(char), size, to);
+    uint32_t total = 0;
+    while ((size = sendfile(to, from, (int*)0, CP_CHUNK_SIZE)) > 0) {
+        total += size;
+    }
+    if (size < 0) {
+        fprintf(stderr, "copy failed\n");
+        goto cp_failed;
     }
 
-    free(buf);
-    fclose(from);
-    fclose(to);
+    close(from);
+    close(to);
+
+    if (timed) {
+        // the close is included, that's when the last dirty blocks are written back
+        get_clock(&end);
+        uint32_t us = clock_elapsed_us(&start, &end);
+        // bytes per us is MB/s, keep two decimals
+        uint32_t rate = div_u64((uint64_t)total * 100, us ? us : 1);
+        printf("%d bytes in %d us, %d.%d%d MB/s\n", total, us, rate / 100, rate / 10 % 10, rate % 10);
+    }
+    optind = 1;
     return 0;
 
 cp_failed:
-    if (from) {
-        fclose(from);
+    if (from >= 0) {
+        close(from);
     }
-    if (to) {
-        fclose(to);
+    if (to >= 0) {
+        close(to);
     }
+    optind = 1;
     return -1;
 }
 
@@ -185,7 +238,8 @@ static int do_exit(int argc, char **argv) {
 }
 
 static int do_ls(int argc, char **argv) {
-    DIR *p_dir = opendir("temp");
+    // list root directory if no path is given
+    DIR *p_dir = opendir(argc > 1 ? argv[1] : "/");
     if (!p_dir) {
         printf("open dir failed");
         return -1;
@@ -220,6 +274,331 @@ static int do_rm(int argc, char **argv) {
     return 0;
 }
 
+static int do_dmesg(int argc, char **argv) {
+    char *buf = malloc(DMESG_BUF_SIZE);
+    if (!buf) {
+        fprintf(stderr, "no memory for dmesg\n");
+        return -1;
+    }
+
+    int size = dmesg(buf, DMESG_BUF_SIZE);
+    if (size > 0) {
+        fflush(stdout);
+        write(1, buf, size);
+    }
+
+    free(buf);
+    return 0;
+}
+
+// reads a dump into a buffer of size bytes, returns its length and the number of entries
+typedef int (*dump_fetch_t)(char *buf, int size, int *count);
+
+// trace and prof dumps are fetched from the kernel as a whole and written to path
+// returns the number of entries written, -1 on failure
+static int dump_to_file(const char *path, int size, dump_fetch_t fetch) {
+    char *buf = malloc(size);
+    if (!buf) {
+        fprintf(stderr, "no memory for the dump\n");
+        return -1;
+    }
+
+    int ret = -1, fd = -1, count = 0;
+    int len = fetch(buf, size, &count);
+    if (len < 0) {
+        fprintf(stderr, "read the dump failed\n");
+        goto dump_failed;
+    }
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC);
+    if (fd < 0) {
+        fprintf(stderr, "open %s failed\n", path);
+        goto dump_failed;
+    }
+
+    if (write(fd, buf, len) != len) {
+        fprintf(stderr, "write %s failed\n", path);
+    } else {
+        ret = count;
+    }
+    close(fd);
+
+dump_failed:
+    free(buf);
+    return ret;
+}
+
+static int trace_fetch(char *buf, int size, int *count) {
+    int len = trace(TRACE_CMD_READ, buf, size);
+    if (len >= 0) {
+        *count = ((trace_header_t*)buf)->count;
+    }
+    return len;
+}
+
+static int prof_fetch(char *buf, int size, int *count) {
+    int len = prof(PROF_CMD_READ, 0, buf, size);
+    if (len >= 0) {
+        *count = ((prof_header_t*)buf)->count;
+    }
+    return len;
+}
+
+// the dump is binary, copy it out of the disk image and run tools/trace2json.py on it
+static int do_trace(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: trace start|stop|dump [file]\n");
+        return -1;
+    }
+
+    if (strcmp(argv[1], "start") == 0) {
+        return trace(TRACE_CMD_START, (char*)0, 0);
+    } else if (strcmp(argv[1], "stop") == 0) {
+        return trace(TRACE_CMD_STOP, (char*)0, 0);
+    } else if (strcmp(argv[1], "dump") != 0) {
+        fprintf(stderr, "unknown trace command: %s\n", argv[1]);
+        return -1;
+    }
+
+    const char *path = argc > 2 ? argv[2] : TRACE_DUMP_FILE;
+    int count = dump_to_file(path, sizeof(trace_header_t) + TRACE_BUF_PAGES * 4096, trace_fetch);
+    if (count < 0) {
+        return -1;
+    }
+    printf("%d records written to %s\n", count, path);
+    return 0;
+}
+
+// like trace, the dump is for tools/prof.py on the host
+static int do_prof(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: prof start [rate]|stop|dump [file]\n");
+        return -1;
+    }
+
+    if (strcmp(argv[1], "start") == 0) {
+        int rate = argc > 2 ? atoi(argv[2]) : 1;
+        if (prof(PROF_CMD_START, rate, (char*)0, 0) < 0) {
+            fprintf(stderr, "start profiler failed, rate is 1 ~ %d\n", PROF_RATE_MAX);
+            return -1;
+        }
+        return 0;
+    } else if (strcmp(argv[1], "stop") == 0) {
+        return prof(PROF_CMD_STOP, 0, (char*)0, 0);
+    } else if (strcmp(argv[1], "dump") != 0) {
+        fprintf(stderr, "unknown prof command: %s\n", argv[1]);
+        return -1;
+    }
+
+    const char *path = argc > 2 ? argv[2] : PROF_DUMP_FILE;
+    int size = sizeof(prof_header_t) + PROF_TASK_NUM * sizeof(prof_task_t) + PROF_BUF_PAGES * 4096;
+    int count = dump_to_file(path, size, prof_fetch);
+    if (count < 0) {
+        return -1;
+    }
+    printf("%d samples written to %s\n", count, path);
+    return 0;
+}
+
+static const char *task_state_name(int state) {
+    static const char *names[] = {"created", "running", "sleep", "ready", "wait", "zombie"};
+    if (state < 0 || state >= sizeof(names) / sizeof(names[0])) {
+        return "?";
+    }
+    return names[state];
+}
+
+static int do_ps(int argc, char **argv) {
+    task_info_t *infos = malloc(TASK_NUM * sizeof(task_info_t));
+    if (!infos) {
+        fprintf(stderr, "no memory for ps\n");
+        return -1;
+    }
+
+    task_clock_t clock;
+    int count = ps(infos, TASK_NUM, &clock);
+    if (count < 0) {
+        fprintf(stderr, "ps failed\n");
+        free(infos);
+        return -1;
+    }
+
+    uint32_t per_ms = clock_cycles_per_ms(&clock);
+    printf("%10s %-12s %-8s %8s %8s %6s %6s %7s %6s %8s %8s %6s %7s\n",
+           "pid", "name", "state", "user ms", "sys ms", "vcsw", "ivcsw", "syscall", "fault", "read", "write",
+           "rss kb", "exec us");
+    for (int i = 0; i < count; i++) {
+        task_info_t *info = infos + i;
+        task_stat_t *stat = &info->stat;
+        printf("%10u %-12.12s %-8s %8u %8u %6u %6u %7u %6u %8u %8u %6u %7u\n",
+               (unsigned)info->pid, info->name, task_state_name(info->state),
+               (unsigned)div_u64(stat->utime, per_ms), (unsigned)div_u64(stat->stime, per_ms),
+               (unsigned)stat->nvcsw, (unsigned)stat->nivcsw, (unsigned)stat->syscalls,
+               (unsigned)stat->faults, (unsigned)stat->read_bytes, (unsigned)stat->write_bytes,
+               (unsigned)info->rss * 4, (unsigned)div_u64(stat->exec_cycles * 1000, per_ms));
+    }
+
+    free(infos);
+    return 0;
+}
+
+// cpu usage of each task in the last interval, refreshed count times (5 by default)
+static int do_top(int argc, char **argv) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 5;
+    task_info_t *infos = malloc(2 * TASK_NUM * sizeof(task_info_t));
+    if (!infos) {
+        fprintf(stderr, "no memory for top\n");
+        return -1;
+    }
+
+    task_info_t *prev = infos, *curr = infos + TASK_NUM;
+    task_clock_t prev_clock, curr_clock;
+    int prev_count = ps(prev, TASK_NUM, &prev_clock);
+    for (int r = 0; r < rounds && prev_count >= 0; r++) {
+        msleep(TOP_INTERVAL_MS);
+        int count = ps(curr, TASK_NUM, &curr_clock);
+        if (count < 0) {
+            break;
+        }
+
+        uint64_t elapsed = curr_clock.tsc - prev_clock.tsc;
+        printf("%s%s", ESC_CLEAR_SCREEN, ESC_MOVE_CURSOR(0, 0));
+        printf("%10s %-12s %-8s %5s %6s %6s %7s %6s\n", "pid", "name", "state", "%cpu", "vcsw", "ivcsw", "syscall", "fault");
+        for (int i = 0; i < count; i++) {
+            task_info_t *info = curr + i;
+            uint64_t used = info->stat.utime + info->stat.stime;
+            task_info_t *old = (task_info_t*)0;
+            for (int j = 0; j < prev_count; j++) {
+                // pids are reused, the name tells an old task from a new one
+                if (prev[j].pid == info->pid && strcmp(prev[j].name, info->name) == 0) {
+                    old = prev + j;
+                    break;
+                }
+            }
+
+            uint32_t vcsw = info->stat.nvcsw, ivcsw = info->stat.nivcsw;
+            uint32_t syscalls = info->stat.syscalls, faults = info->stat.faults;
+            if (old) {
+                used -= old->stat.utime + old->stat.stime;
+                vcsw -= old->stat.nvcsw;
+                ivcsw -= old->stat.nivcsw;
+                syscalls -= old->stat.syscalls;
+                faults -= old->stat.faults;
+            }
+            printf("%10u %-12.12s %-8s %5u %6u %6u %7u %6u\n",
+                   (unsigned)info->pid, info->name, task_state_name(info->state),
+                   (unsigned)div_u64(used * 100, elapsed),
+                   (unsigned)vcsw, (unsigned)ivcsw, (unsigned)syscalls, (unsigned)faults);
+        }
+
+        task_info_t *tmp = prev;
+        prev = curr;
+        curr = tmp;
+        prev_count = count;
+        prev_clock = curr_clock;
+    }
+
+    free(infos);
+    return 0;
+}
+
+// microseconds from start to end
+// open the same file until the fd table is full, then close every other fd,
+// reopen them (they get the lowest free fds back) and close everything
+static int do_openbench(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : OPENBENCH_FILE;
+    int rounds = argc > 2 ? atoi(argv[2]) : 10;
+    int *fds = malloc(OPENBENCH_MAX_FILES * sizeof(int));
+    if (!fds) {
+        fprintf(stderr, "no memory for openbench\n");
+        return -1;
+    }
+
+    uint32_t open_us = 0, close_us = 0, opens = 0, closes = 0;
+    int count = 0;
+    for (int r = 0; r < rounds; r++) {
+        task_clock_t start, end;
+        get_clock(&start);
+        for (count = 0; count < OPENBENCH_MAX_FILES; count++) {
+            fds[count] = open(path, O_RDONLY);
+            if (fds[count] < 0) {
+                break;
+            }
+        }
+        get_clock(&end);
+        open_us += clock_elapsed_us(&start, &end);
+        opens += count + 1; // with the one that failed
+
+        if (count == 0) {
+            fprintf(stderr, "open %s failed\n", path);
+            free(fds);
+            return -1;
+        }
+
+        get_clock(&start);
+        for (int i = 0; i < count; i += 2) {
+            close(fds[i]);
+        }
+        for (int i = 0; i < count; i += 2) {
+            fds[i] = open(path, O_RDONLY);
+        }
+        for (int i = 0; i < count; i++) {
+            close(fds[i]);
+        }
+        get_clock(&end);
+        close_us += clock_elapsed_us(&start, &end);
+        closes += count + (count + 1) / 2 * 2;
+    }
+
+    printf("%d files open at most, %d rounds\n", count, rounds);
+    printf("open: %u us in total, %u ns each\n", (unsigned)open_us, (unsigned)div_u64((uint64_t)open_us * 1000, opens));
+    printf("close and reopen: %u us in total, %u ns each\n", (unsigned)close_us, (unsigned)div_u64((uint64_t)close_us * 1000, closes));
+    free(fds);
+    return 0;
+}
+
+// cat-style output: lines of text written to the console, write size 1 shows the
+// cost per char the way the tty used to take it
+static int do_ttybench(int argc, char **argv) {
+    int bytes = argc > 1 ? atoi(argv[1]) : TTYBENCH_BYTES;
+    int size = argc > 2 ? atoi(argv[2]) : TTYBENCH_WRITE_SIZE;
+    if (bytes <= 0 || size <= 0 || size > TTYBENCH_MAX_WRITE) {
+        fprintf(stderr, "usage: ttybench [bytes] [write size 1 ~ %d]\n", TTYBENCH_MAX_WRITE);
+        return -1;
+    }
+
+    char *buf = malloc(size);
+    if (!buf) {
+        fprintf(stderr, "no memory for ttybench\n");
+        return -1;
+    }
+    // 79 chars and a '\n' per line, so every line scrolls the screen once
+    for (int i = 0; i < size; i++) {
+        buf[i] = (i % 80 == 79) ? '\n' : 'a' + i % 26;
+    }
+    fflush(stdout);
+
+    task_clock_t start, end;
+    get_clock(&start);
+    int written = 0;
+    while (written < bytes) {
+        int n = bytes - written < size ? bytes - written : size;
+        if (write(1, buf, n) != n) {
+            fprintf(stderr, "write failed\n");
+            free(buf);
+            return -1;
+        }
+        written += n;
+    }
+    get_clock(&end);
+    free(buf);
+
+    uint32_t us = clock_elapsed_us(&start, &end);
+    printf("\n%d bytes in %d byte writes, %u us, %u chars/s\n", written, size, (unsigned)us,
+           (unsigned)div_u64((uint64_t)written * 1000000, us ? us : 1));
+    return 0;
+}
+
 static const cli_cmd_t cmd_list[] = {
     {
         .name = "help",
@@ -238,7 +617,7 @@ static const cli_cmd_t cmd_list[] = {
     },
     {
         .name = "ls",
-        .usage = "ls -- list directory",
+        .usage = "ls [dir] -- list directory",
         .do_func = do_ls,
     },
     {
@@ -248,7 +627,7 @@ static const cli_cmd_t cmd_list[] = {
     },
     {
         .name = "cp",
-        .usage = "cp src dest -- copy file",
+        .usage = "cp [-t] src dest -- copy file, -t shows the speed",
         .do_func = do_cp,
     },
     {
@@ -256,6 +635,41 @@ static const cli_cmd_t cmd_list[] = {
         .usage = "rm file - remove file",
         .do_func = do_rm,
     },
+    {
+        .name = "dmesg",
+        .usage = "dmesg -- show kernel log",
+        .do_func = do_dmesg,
+    },
+    {
+        .name = "trace",
+        .usage = "trace start|stop|dump [file] -- record kernel events",
+        .do_func = do_trace,
+    },
+    {
+        .name = "prof",
+        .usage = "prof start [rate]|stop|dump [file] -- sample where the cpu spends time",
+        .do_func = do_prof,
+    },
+    {
+        .name = "ps",
+        .usage = "ps -- show tasks and the cpu time they used",
+        .do_func = do_ps,
+    },
+    {
+        .name = "top",
+        .usage = "top [count] -- show cpu usage of tasks every second",
+        .do_func = do_top,
+    },
+    {
+        .name = "openbench",
+        .usage = "openbench [file] [rounds] -- time open and close with a full fd table",
+        .do_func = do_openbench,
+    },
+    {
+        .name = "ttybench",
+        .usage = "ttybench [bytes] [write size] -- console output speed in chars/s",
+        .do_func = do_ttybench,
+    },
     {
         .name = "quit",
         .usage = "quit -- quit from shell",
@@ -328,6 +742,111 @@ static void run_exec_file(const char *path, int argc, char **argv) {
     }
 }
 
+// strtok sets the delim to '\0' and return the position of token
+static int parse_args(char *cmd, char **argv) {
+    int argc = 0;
+    const char *delim = " ";
+    char *token = strtok(cmd, delim);
+    while (token && argc < CLI_MAX_ARG_NUM - 1) {
+        argv[argc++] = token;
+        token = strtok(NULL, delim);
+    }
+    argv[argc] = (char*)0;
+    return argc;
+}
+
+// cut the input at every '|', returns the number of commands
+static int split_pipeline(char *input, char **cmds) {
+    int count = 0;
+    cmds[count++] = input;
+    for (char *p = input; *p; p++) {
+        if (*p == '|' && count < CLI_MAX_PIPE_NUM) {
+            *p = '\0';
+            cmds[count++] = p + 1;
+        }
+    }
+    return count;
+}
+
+// runs in the forked child with stdin and stdout already connected, never returns
+static void run_pipeline_cmd(char *cmd) {
+    char *argv[CLI_MAX_ARG_NUM];
+    int argc = parse_args(cmd, argv);
+    if (argc == 0) {
+        exit(-1);
+    }
+
+    const cli_cmd_t *builtin = find_builtin_cmd(argv[0]);
+    if (builtin) {
+        // exit flushes stdout into the pipe
+        exit(run_builtin_func(builtin, argc, argv));
+    }
+
+    if (check_file_exist(argv[0]) < 0 || execve(argv[0], argv, (char *const *)0) < 0) {
+        fprintf(stderr, ESC_COLOR_ERROR"Not a builtin command: %s"ESC_COLOR_DEFAULT"\n", argv[0]);
+    }
+    exit(-1);
+}
+
+// cmd1 | cmd2 | ... every command runs in its own process,
+// the stdout of one is connected to the stdin of the next with a pipe
+// fd 0 and 1 are replaced by closing them first, since dup returns the lowest free fd
+static void run_pipeline(char **cmds, int cmd_count) {
+    int prev_read = -1; // read end of the pipe from the previous command
+    int child_count = 0;
+
+    fflush(stdout); // or the children print it again
+    for (int i = 0; i < cmd_count; i++) {
+        int fds[2] = {-1, -1};
+        if (i < cmd_count - 1 && pipe(fds) < 0) {
+            fprintf(stderr, "pipe failed\n");
+            break;
+        }
+
+        int pid = fork();
+        if (pid < 0) {
+            fprintf(stderr, "fork failed\n");
+            if (fds[0] >= 0) {
+                close(fds[0]);
+                close(fds[1]);
+            }
+            break;
+        } else if (pid == 0) {
+            if (prev_read >= 0) {
+                close(0);
+                dup(prev_read);
+                close(prev_read);
+            }
+            if (fds[1] >= 0) {
+                close(1);
+                dup(fds[1]);
+                close(fds[0]);
+                close(fds[1]);
+            }
+            run_pipeline_cmd(cmds[i]);
+        }
+
+        child_count++;
+        // only the children keep the ends, or the readers never see the end of data
+        if (prev_read >= 0) {
+            close(prev_read);
+        }
+        if (fds[1] >= 0) {
+            close(fds[1]);
+        }
+        prev_read = fds[0];
+    }
+
+    if (prev_read >= 0) {
+        close(prev_read);
+    }
+
+    while (child_count-- > 0) {
+        int status;
+        wait(&status);
+    }
+}
+
 int main(int argc, char **argv) {
 #if 0
     // char* ret = sbrk(0);
@@ -401,18 +920,15 @@ int main(int argc, char **argv) {
             *ch = '\0';
         }
 
-        int argc = 0;
-        char *argv[CLI_MAX_ARG_NUM];
-        memset(argv, CLI_MAX_ARG_NUM, sizeof(char*));
-
-        // strtok sets the delim to '\0' and return the position of token
-        const char *delim = " ";
-        char *token = strtok(cli.curr_input, delim);
-        while (token) {
-            argv[argc++] = token;
-            token = strtok(NULL, delim);
+        char *cmds[CLI_MAX_PIPE_NUM];
+        int cmd_count = split_pipeline(cli.curr_input, cmds);
+        if (cmd_count > 1) {
+            run_pipeline(cmds, cmd_count);
+            continue;
         }
 
+        char *argv[CLI_MAX_ARG_NUM];
+        int argc = parse_args(cli.curr_input, argv);
         if (argc == 0) {
             continue;
         }
@@ -3,6 +3,17 @@
 
 #define CLI_INPUT_SIZE 1024
 #define CLI_MAX_ARG_NUM 10
+#define CLI_MAX_PIPE_NUM 8 // commands in a pipeline
+#define CP_CHUNK_SIZE (64 * 1024) // bytes copied by a sendfile in cp
+#define DMESG_BUF_SIZE (16 * 1024)
+#define TRACE_DUMP_FILE "trace.bin"
+#define PROF_DUMP_FILE "prof.bin"
+#define TOP_INTERVAL_MS 1000
+#define OPENBENCH_MAX_FILES 128 // OPEN_FILE_NUM of the kernel, open fails before that
+#define OPENBENCH_FILE "shell.elf"
+#define TTYBENCH_BYTES (64 * 1024) // written to the console by ttybench by default
+#define TTYBENCH_WRITE_SIZE 512 // bytes per write, at most TTYBENCH_MAX_WRITE
+#define TTYBENCH_MAX_WRITE 4096
 #define ESC_CMD2(Pn, cmd) "\x1b["#Pn#cmd // it is used in printf so need quotes
 #define ESC_CLEAR_SCREEN ESC_CMD2(2, J)
 #define ESC_COLOR_ERROR ESC_CMD2(31, m)
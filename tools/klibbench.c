@@ -0,0 +1,280 @@
+// host microbenchmark for the klib memory routines
+//
+// build (32 bit, klib is written for i386):
+//   gcc -m32 -O2 -I source -I source/kernel/include -o klibbench tools/klibbench.c source/kernel/tools/klib.c
+// run:
+//   ./klibbench [rounds]
+//
+// every routine is checked against libc first, then timed for a range of sizes and
+// destination/source alignments next to a plain byte loop (what klib did before the
+// rep movs/stos versions) and libc. the numbers are ns per call and MB/s
+//
+// the kernel headers define their own uint32_t, so stdint.h is not included here
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "tools/klib.h"
+
+#define PAGE_SIZE 4096
+#define MAX_SIZE (64 * 1024)
+#define BUF_SIZE (MAX_SIZE + 2 * PAGE_SIZE)
+
+static const int sizes[] = {1, 3, 8, 15, 16, 17, 64, 255, 512, 4096, 65536};
+static const int aligns[][2] = {{0, 0}, {1, 0}, {0, 1}, {3, 1}, {2, 2}}; // dest, src
+#define COUNT(a) (int)(sizeof(a) / sizeof(a[0]))
+
+// klib.c pulls these in for panic, nothing here calls them
+void log_printf(const char *fmt, ...) {
+}
+
+void log_flush(void) {
+}
+
+static void byte_memcpy(void *dest, const void *src, int n) {
+    uint8_t *d = dest;
+    const uint8_t *s = src;
+    while (n--) {
+        *d++ = *s++;
+    }
+}
+
+static void byte_memset(void *dest, uint8_t v, int n) {
+    uint8_t *d = dest;
+    while (n--) {
+        *d++ = v;
+    }
+}
+
+static int byte_memcmp(const void *d1, const void *d2, int n) {
+    const uint8_t *b1 = d1, *b2 = d2;
+    for (int i = 0; i < n; i++) {
+        if (b1[i] != b2[i]) {
+            return b1[i] < b2[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+static void libc_memcpy(void *dest, const void *src, int n) {
+    memcpy(dest, src, n);
+}
+
+static void libc_memset(void *dest, uint8_t v, int n) {
+    memset(dest, v, n);
+}
+
+static int libc_memcmp(const void *d1, const void *d2, int n) {
+    int r = memcmp(d1, d2, n);
+    return r < 0 ? -1 : r > 0;
+}
+
+static void byte_page_copy(void *dest, const void *src) {
+    byte_memcpy(dest, src, PAGE_SIZE);
+}
+
+static void byte_page_zero(void *dest) {
+    byte_memset(dest, 0, PAGE_SIZE);
+}
+
+static void libc_page_copy(void *dest, const void *src) {
+    memcpy(dest, src, PAGE_SIZE);
+}
+
+static void libc_page_zero(void *dest) {
+    memset(dest, 0, PAGE_SIZE);
+}
+
+typedef struct {
+    const char *name;
+    void (*cpy)(void *dest, const void *src, int n);
+    void (*set)(void *dest, uint8_t v, int n);
+    int (*cmp)(const void *d1, const void *d2, int n);
+    void (*page_copy)(void *dest, const void *src);
+    void (*page_zero)(void *dest);
+} impl_t;
+
+static const impl_t impls[] = {
+    {"klib", kernel_memcpy, kernel_memset, kernel_memcmp, kernel_page_copy, kernel_page_zero},
+    {"byte", byte_memcpy, byte_memset, byte_memcmp, byte_page_copy, byte_page_zero},
+    {"libc", libc_memcpy, libc_memset, libc_memcmp, libc_page_copy, libc_page_zero},
+};
+
+static uint8_t *buf_a, *buf_b, *buf_c;
+
+// keeps the compiler from dropping calls whose result isn't used
+static volatile int sink;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// enough calls that every measurement moves about the same amount of data
+static int calls_for(int size, int rounds) {
+    int calls = rounds * (MAX_SIZE / size);
+    return calls > 1000000 ? 1000000 : calls;
+}
+
+static void fill(uint8_t *p, int n, int seed) {
+    for (int i = 0; i < n; i++) {
+        p[i] = (uint8_t)(i * 31 + seed);
+    }
+}
+
+static int check(const char *what, int size, int da, int sa, int ok) {
+    if (!ok) {
+        fprintf(stderr, "%s is wrong: size %d, dest align %d, src align %d\n", what, size, da, sa);
+    }
+    return ok;
+}
+
+// results are compared with libc, including the bytes around the range
+// so writes past either end are caught
+static int verify(void) {
+    int ok = 1;
+    const impl_t *k = &impls[0];
+    for (int i = 0; i < COUNT(sizes); i++) {
+        int n = sizes[i];
+        for (int j = 0; j < COUNT(aligns); j++) {
+            int da = aligns[j][0], sa = aligns[j][1];
+            uint8_t *d = buf_a + PAGE_SIZE + da, *s = buf_b + PAGE_SIZE + sa;
+
+            fill(buf_a, BUF_SIZE, 1);
+            fill(buf_b, BUF_SIZE, 2);
+            memcpy(buf_c, buf_a, BUF_SIZE);
+            k->cpy(d, s, n);
+            memcpy(buf_c + PAGE_SIZE + da, s, n);
+            ok &= check("kernel_memcpy", n, da, sa, memcmp(buf_a, buf_c, BUF_SIZE) == 0);
+
+            fill(buf_a, BUF_SIZE, 1);
+            memcpy(buf_c, buf_a, BUF_SIZE);
+            k->set(d, 0xA5, n);
+            memset(buf_c + PAGE_SIZE + da, 0xA5, n);
+            ok &= check("kernel_memset", n, da, sa, memcmp(buf_a, buf_c, BUF_SIZE) == 0);
+
+            // equal, then a difference in the first, a middle and the last byte
+            fill(d, n, 3);
+            fill(s, n, 3);
+            ok &= check("kernel_memcmp", n, da, sa, k->cmp(d, s, n) == 0);
+            int pos[] = {0, n / 2, n - 1};
+            for (int p = 0; p < COUNT(pos); p++) {
+                s[pos[p]] ^= 0x80;
+                ok &= check("kernel_memcmp", n, da, sa, k->cmp(d, s, n) == libc_memcmp(d, s, n));
+                ok &= check("kernel_memcmp", n, da, sa, k->cmp(s, d, n) == libc_memcmp(s, d, n));
+                s[pos[p]] ^= 0x80;
+            }
+        }
+    }
+
+    fill(buf_a, BUF_SIZE, 1);
+    fill(buf_b, BUF_SIZE, 2);
+    memcpy(buf_c, buf_a, BUF_SIZE);
+    k->page_copy(buf_a + PAGE_SIZE, buf_b + PAGE_SIZE);
+    memcpy(buf_c + PAGE_SIZE, buf_b + PAGE_SIZE, PAGE_SIZE);
+    ok &= check("kernel_page_copy", PAGE_SIZE, 0, 0, memcmp(buf_a, buf_c, BUF_SIZE) == 0);
+
+    k->page_zero(buf_a + PAGE_SIZE);
+    memset(buf_c + PAGE_SIZE, 0, PAGE_SIZE);
+    ok &= check("kernel_page_zero", PAGE_SIZE, 0, 0, memcmp(buf_a, buf_c, BUF_SIZE) == 0);
+    return ok;
+}
+
+static void report(const char *op, const char *impl, int size, int da, int sa, int calls, double ns) {
+    double per_call = ns / calls;
+    printf("%-10s %-5s %6d %3d %3d %10.1f %10.1f\n", op, impl, size, da, sa,
+            per_call, size / per_call * 1e9 / (1024 * 1024));
+}
+
+static void bench_sizes(int rounds) {
+    for (int i = 0; i < COUNT(sizes); i++) {
+        int n = sizes[i];
+        int calls = calls_for(n, rounds);
+        for (int j = 0; j < COUNT(aligns); j++) {
+            int da = aligns[j][0], sa = aligns[j][1];
+            uint8_t *d = buf_a + PAGE_SIZE + da, *s = buf_b + PAGE_SIZE + sa;
+
+            for (int m = 0; m < COUNT(impls); m++) {
+                const impl_t *impl = &impls[m];
+                double start = now_ns();
+                for (int c = 0; c < calls; c++) {
+                    impl->cpy(d, s, n);
+                }
+                report("memcpy", impl->name, n, da, sa, calls, now_ns() - start);
+            }
+
+            for (int m = 0; m < COUNT(impls); m++) {
+                const impl_t *impl = &impls[m];
+                double start = now_ns();
+                for (int c = 0; c < calls; c++) {
+                    impl->set(d, (uint8_t)c, n);
+                }
+                report("memset", impl->name, n, da, sa, calls, now_ns() - start);
+            }
+
+            // equal buffers, the whole range has to be scanned
+            memcpy(d, s, n);
+            for (int m = 0; m < COUNT(impls); m++) {
+                const impl_t *impl = &impls[m];
+                double start = now_ns();
+                for (int c = 0; c < calls; c++) {
+                    sink += impl->cmp(d, s, n);
+                }
+                report("memcmp", impl->name, n, da, sa, calls, now_ns() - start);
+            }
+        }
+    }
+}
+
+static void bench_pages(int rounds) {
+    int calls = calls_for(PAGE_SIZE, rounds);
+    uint8_t *d = buf_a + PAGE_SIZE, *s = buf_b + PAGE_SIZE;
+    for (int m = 0; m < COUNT(impls); m++) {
+        const impl_t *impl = &impls[m];
+        double start = now_ns();
+        for (int c = 0; c < calls; c++) {
+            impl->page_copy(d, s);
+        }
+        report("page_copy", impl->name, PAGE_SIZE, 0, 0, calls, now_ns() - start);
+    }
+
+    for (int m = 0; m < COUNT(impls); m++) {
+        const impl_t *impl = &impls[m];
+        double start = now_ns();
+        for (int c = 0; c < calls; c++) {
+            impl->page_zero(d);
+        }
+        report("page_zero", impl->name, PAGE_SIZE, 0, 0, calls, now_ns() - start);
+    }
+}
+
+int main(int argc, char **argv) {
+    int rounds = argc > 1 ? atoi(argv[1]) : 200;
+    if (rounds <= 0) {
+        rounds = 1;
+    }
+
+    // page aligned, so the alignment offsets above are exact
+    buf_a = aligned_alloc(PAGE_SIZE, BUF_SIZE);
+    buf_b = aligned_alloc(PAGE_SIZE, BUF_SIZE);
+    buf_c = aligned_alloc(PAGE_SIZE, BUF_SIZE);
+    if (!buf_a || !buf_b || !buf_c) {
+        fprintf(stderr, "no memory\n");
+        return 1;
+    }
+
+    if (!verify()) {
+        return 1;
+    }
+
+    printf("%-10s %-5s %6s %3s %3s %10s %10s\n", "op", "impl", "size", "dst", "src", "ns/call", "MB/s");
+    bench_sizes(rounds);
+    bench_pages(rounds);
+
+    free(buf_a);
+    free(buf_b);
+    free(buf_c);
+    return 0;
+}
@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+# flat profile from a profiler dump (shell: prof dump [file])
+#
+# usage: prof.py prof.bin kernel.elf [user elf dir]
+#
+# kernel samples are looked up in kernel.elf. all user programs are linked at the same
+# address, so user samples are looked up in the elf named after the task
+# (shell.elf, loop.elf...) found in the user elf dir
+# symbols come from nm, set NM to use a cross nm (i686-elf-nm)
+#
+# the layout of the dump is prof_header_t, prof_task_t[task_count], prof_sample_t[count]
+# see kernel/include/tools/prof.h
+
+import bisect
+import collections
+import os
+import struct
+import subprocess
+import sys
+
+PROF_MAGIC = 0x464F5250
+PROF_TASK_NONE = 0xFF
+HEADER = struct.Struct("<7I")
+TASK = struct.Struct("<I32s")
+SAMPLE = struct.Struct("<IIBBxx")
+
+
+def read_dump(path):
+    with open(path, "rb") as f:
+        data = f.read()
+
+    if len(data) < HEADER.size:
+        sys.exit("%s: too short" % path)
+    magic, version, sample_size, task_count, count, lost, hz = HEADER.unpack_from(data, 0)
+    if magic != PROF_MAGIC or sample_size != SAMPLE.size:
+        sys.exit("%s: not a profiler dump" % path)
+
+    offset = HEADER.size
+    tasks = []
+    for _ in range(task_count):
+        pid, name = TASK.unpack_from(data, offset)
+        tasks.append((pid, name.split(b"\0")[0].decode(errors="replace")))
+        offset += TASK.size
+
+    samples = []
+    for _ in range(count):
+        if offset + SAMPLE.size > len(data):
+            break
+        samples.append(SAMPLE.unpack_from(data, offset))
+        offset += SAMPLE.size
+    return {"lost": lost, "hz": hz}, tasks, samples
+
+
+class Symbols:
+    def __init__(self, path):
+        self.addrs = []
+        self.names = []
+        if not path or not os.path.exists(path):
+            return
+
+        nm = os.environ.get("NM", "nm")
+        out = subprocess.run([nm, "-n", "--defined-only", path],
+                             stdout=subprocess.PIPE, universal_newlines=True, check=True).stdout
+        for line in out.splitlines():
+            parts = line.split()
+            if len(parts) != 3 or parts[1] not in "tTwW":
+                continue
+            self.addrs.append(int(parts[0], 16))
+            self.names.append(parts[2])
+
+    def lookup(self, addr):
+        i = bisect.bisect_right(self.addrs, addr) - 1
+        if i < 0:
+            return "0x%x" % addr
+        return self.names[i]
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit("usage: %s prof.bin kernel.elf [user elf dir]" % sys.argv[0])
+
+    info, tasks, samples = read_dump(sys.argv[1])
+    kernel = Symbols(sys.argv[2])
+    user_dir = sys.argv[3] if len(sys.argv) > 3 else os.path.dirname(sys.argv[2])
+    user_syms = {}
+
+    def user_symbols(name):
+        if name not in user_syms:
+            user_syms[name] = Symbols(os.path.join(user_dir, name))
+        return user_syms[name]
+
+    funcs = collections.Counter()
+    modes = collections.Counter()
+    per_task = collections.Counter()
+    for eip, pid, cpl, task in samples:
+        name = tasks[task][1] if task != PROF_TASK_NONE and task < len(tasks) else "?"
+        per_task["%s (pid %d)" % (name, pid)] += 1
+        if cpl == 0:
+            modes["kernel"] += 1
+            funcs["[k] " + kernel.lookup(eip)] += 1
+        else:
+            modes["user"] += 1
+            funcs["[u] %s: %s" % (name, user_symbols(name).lookup(eip))] += 1
+
+    total = len(samples)
+    if total == 0:
+        print("no samples")
+        return
+
+    print("%d samples at %d Hz, %d lost" % (total, info["hz"], info["lost"]))
+    print("kernel %.1f%%, user %.1f%%" % (modes["kernel"] * 100.0 / total, modes["user"] * 100.0 / total))
+    print()
+    print("%8s %7s  task" % ("samples", "%"))
+    for name, n in per_task.most_common():
+        print("%8d %6.1f%%  %s" % (n, n * 100.0 / total, name))
+    print()
+    print("%8s %7s  function" % ("samples", "%"))
+    for name, n in funcs.most_common():
+        print("%8d %6.1f%%  %s" % (n, n * 100.0 / total, name))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,163 @@
+#!/usr/bin/env python3
+# convert a kernel trace dump (shell: trace dump [file]) to chrome trace json
+# the output can be opened in chrome://tracing or https://ui.perfetto.dev
+#
+# usage: trace2json.py trace.bin [trace.json]
+#
+# the layout of the dump is trace_header_t followed by trace_record_t,
+# see kernel/include/tools/trace.h
+
+import json
+import struct
+import sys
+
+TRACE_MAGIC = 0x45435254
+HEADER = struct.Struct("<8I2Q")
+RECORD = struct.Struct("<QBBxxIII")
+
+TRACE_SWITCH = 1
+TRACE_SYSCALL = 2
+TRACE_DISK_READ = 3
+TRACE_DISK_WRITE = 4
+TRACE_PAGE_FAULT = 5
+TRACE_MUTEX_WAIT = 6
+
+TRACE_INSTANT = 0
+TRACE_BEGIN = 1
+TRACE_END = 2
+
+EVENT_NAMES = {
+    TRACE_DISK_READ: "disk read",
+    TRACE_DISK_WRITE: "disk write",
+    TRACE_PAGE_FAULT: "page fault",
+    TRACE_MUTEX_WAIT: "mutex wait",
+}
+
+# kernel/include/core/syscall.h
+SYSCALL_NAMES = {
+    0: "msleep", 1: "getpid", 2: "fork", 3: "execve", 4: "yield", 5: "exit", 6: "wait",
+    50: "open", 51: "read", 52: "write", 53: "close", 54: "lseek", 55: "isatty",
+    56: "sbrk", 57: "fstat", 58: "dup", 59: "ioctl", 60: "opendir", 61: "readdir",
+    62: "closedir", 63: "unlink", 64: "mmap", 65: "munmap", 66: "pipe",
+    67: "sendfile", 68: "dmesg", 69: "trace",
+}
+
+CPU_PID = 0 # process that holds the cpu track
+TASK_PID = 1 # process that holds one thread per task
+
+
+def u32(v):
+    return v - (1 << 32) if v & (1 << 31) else v
+
+
+def read_dump(path):
+    with open(path, "rb") as f:
+        data = f.read()
+
+    if len(data) < HEADER.size:
+        sys.exit("%s: too short" % path)
+    (magic, version, record_size, count, lost, tick_ms,
+     start_tick, end_tick, start_tsc, end_tsc) = HEADER.unpack_from(data, 0)
+    if magic != TRACE_MAGIC or record_size != RECORD.size:
+        sys.exit("%s: not a trace dump" % path)
+
+    header = {
+        "version": version, "count": count, "lost": lost, "tick_ms": tick_ms,
+        "start_tick": start_tick, "end_tick": end_tick,
+        "start_tsc": start_tsc, "end_tsc": end_tsc,
+    }
+    records = []
+    offset = HEADER.size
+    for _ in range(count):
+        if offset + RECORD.size > len(data):
+            break
+        records.append(RECORD.unpack_from(data, offset))
+        offset += RECORD.size
+    return header, records
+
+
+def tsc_per_us(header):
+    ms = (header["end_tick"] - header["start_tick"]) * header["tick_ms"]
+    if ms <= 0:
+        return 1000.0 # less than a tick traced, guess 1GHz
+    return (header["end_tsc"] - header["start_tsc"]) / (ms * 1000.0)
+
+
+def convert(header, records):
+    rate = tsc_per_us(header)
+    base = records[0][0] if records else 0
+    events = []
+    tasks = set()
+    depth = {} # open B events per task, ends without a begin are dropped
+    running = None # (pid, ts) of the task on the cpu
+
+    def ts_of(tsc):
+        return (tsc - base) / rate
+
+    for tsc, event, phase, pid, arg0, arg1 in records:
+        ts = ts_of(tsc)
+        tasks.add(pid)
+
+        if event == TRACE_SWITCH:
+            if running is not None:
+                events.append({"name": "pid %d" % running[0], "ph": "X", "pid": CPU_PID, "tid": 0,
+                               "ts": running[1], "dur": ts - running[1]})
+            running = (arg0, ts)
+            tasks.add(arg0)
+            continue
+
+        if event == TRACE_SYSCALL:
+            name = SYSCALL_NAMES.get(arg0, "syscall %d" % arg0)
+            args = {"ret": u32(arg1)} if phase == TRACE_END else {}
+        else:
+            name = EVENT_NAMES.get(event, "event %d" % event)
+            if event == TRACE_PAGE_FAULT:
+                args = {"addr": hex(arg0), "err": arg1} if phase == TRACE_BEGIN else {"result": u32(arg1)}
+            elif event == TRACE_MUTEX_WAIT:
+                args = {"mutex": hex(arg0), "owner": arg1} if phase == TRACE_BEGIN else {}
+            else:
+                args = {"sector": arg0, "count": u32(arg1)} if phase == TRACE_BEGIN else {"ret": u32(arg1)}
+
+        if phase == TRACE_BEGIN:
+            depth[pid] = depth.get(pid, 0) + 1
+            ph = "B"
+        elif phase == TRACE_END:
+            if depth.get(pid, 0) == 0:
+                continue
+            depth[pid] -= 1
+            ph = "E"
+        else:
+            ph = "i"
+        events.append({"name": name, "ph": ph, "pid": TASK_PID, "tid": pid, "ts": ts, "args": args})
+
+    if running is not None and records:
+        end = ts_of(records[-1][0])
+        events.append({"name": "pid %d" % running[0], "ph": "X", "pid": CPU_PID, "tid": 0,
+                       "ts": running[1], "dur": end - running[1]})
+
+    events.append({"name": "process_name", "ph": "M", "pid": CPU_PID, "args": {"name": "cpu"}})
+    events.append({"name": "process_name", "ph": "M", "pid": TASK_PID, "args": {"name": "tasks"}})
+    for pid in sorted(tasks):
+        events.append({"name": "thread_name", "ph": "M", "pid": TASK_PID, "tid": pid,
+                       "args": {"name": "pid %d" % pid}})
+
+    return {
+        "traceEvents": events,
+        "displayTimeUnit": "ns",
+        "otherData": {"lost": header["lost"], "tsc_per_us": rate},
+    }
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit("usage: %s trace.bin [trace.json]" % sys.argv[0])
+
+    header, records = read_dump(sys.argv[1])
+    out = sys.argv[2] if len(sys.argv) > 2 else "trace.json"
+    with open(out, "w") as f:
+        json.dump(convert(header, records), f)
+    print("%d records, %d lost -> %s" % (len(records), header["lost"], out))
+
+
+if __name__ == "__main__":
+    main()